@@ -3,8 +3,29 @@
 set -xe
 
 target=${1:-chess}
-LIBS="$(pkg-config --libs raylib)"
-CFLAGS="-O3 -Wall -Wextra $(pkg-config --cflags raylib)"
+LIBS="$(pkg-config --libs raylib) -lm"
+CFLAGS="-O3 -Wall -Wextra -pthread"
+# BOARD=0x88 walks the board with 0x88 squares and smaller tables
+if [ "$BOARD" = 0x88 ]; then
+    CFLAGS="$CFLAGS -DBOARD_0X88"
+fi
+
+# VERIFY=1 checks recorded legal moves against full recomputation
+# and simulates the moves it recomputes on a pool of worker threads
+if [ -n "$VERIFY" ]; then
+    CFLAGS="$CFLAGS -DVERIFY_LEGAL_MOVES"
+    VERIFY_SOURCE="src/workers.c"
+fi
+
 CC=clang
 
-$CC $CFLAGS -o "$target" src/chess.c src/colorizers.c src/fillers.c src/handlers.c src/recorders.c src/tools.c $LIBS
+# Bake derived state of positions in the first plies of a standard game
+RULES="src/attacks.c src/fillers.c src/masks.c src/material.c src/memo.c src/openings.c src/recorders.c src/tools.c src/zobrist.c $VERIFY_SOURCE"
+$CC $CFLAGS -DNO_OPENING_TABLE -Isrc -o bake_openings tools/bake_openings.c $RULES
+./bake_openings "${OPENING_PLIES:-3}" > src/opening_table.c
+
+ENGINE="src/engine.c src/position.c src/search.c"
+$CC $CFLAGS $(pkg-config --cflags raylib) -o "$target" $RULES $ENGINE src/chess.c src/colorizers.c src/handlers.c src/opening_table.c src/successors.c $LIBS
+
+# The engine alone over UCI, without raylib
+$CC $CFLAGS -o "$target-uci" $RULES src/opening_table.c src/position.c src/search.c src/uci.c
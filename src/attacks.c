@@ -0,0 +1,479 @@
+#include "attacks.h"
+#include "masks.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ATTACKS_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+#define ALL_CELLS       0xffffffffffffffffULL
+#define NOT_A_FILE      0xfefefefefefefefeULL
+#define NOT_AB_FILE     0xfcfcfcfcfcfcfcfcULL
+#define NOT_H_FILE      0x7f7f7f7f7f7f7f7fULL
+#define NOT_GH_FILE     0x3f3f3f3f3f3f3f3fULL
+
+// A shift of the whole board by one step, and the cells that step can land
+// on without wrapping around to the other edge
+typedef struct {
+    int shift;
+    Mask wrap;
+} Step;
+
+// Orthogonal steps first, then diagonal ones
+static const Step slides[8] = {
+    {1, NOT_A_FILE}, {-1, NOT_H_FILE}, {8, ALL_CELLS}, {-8, ALL_CELLS},
+    {9, NOT_A_FILE}, {7, NOT_H_FILE}, {-7, NOT_A_FILE}, {-9, NOT_H_FILE},
+};
+
+static const Step jumps[8] = {
+    {17, NOT_A_FILE}, {15, NOT_H_FILE}, {-15, NOT_A_FILE}, {-17, NOT_H_FILE},
+    {10, NOT_AB_FILE}, {6, NOT_GH_FILE}, {-6, NOT_AB_FILE}, {-10, NOT_GH_FILE},
+};
+
+// Black pawns capture downwards, white pawns upwards
+static const Step pawn_captures[2][2] = {
+    {{9, NOT_A_FILE}, {7, NOT_H_FILE}},
+    {{-7, NOT_A_FILE}, {-9, NOT_H_FILE}},
+};
+
+void loadAttackBatchLane(AttackBatch *batch, int lane, const Board *b)
+{
+    for (int c = 0; c < 2; c++)
+        for (int t = 0; t < 6; t++)
+            batch->pieces[c][t][lane] = b->pieces[c][t];
+    batch->occupied[lane] = b->occupied[black] | b->occupied[white];
+}
+
+// Empties a lane, for batches that aren't full
+void clearAttackBatchLane(AttackBatch *batch, int lane)
+{
+    for (int c = 0; c < 2; c++)
+        for (int t = 0; t < 6; t++)
+            batch->pieces[c][t][lane] = 0;
+    batch->occupied[lane] = 0;
+}
+
+// Marks cells attacked by one color as dangerous for the other, the same as
+// recordDangerousCells does for a single board
+void storeDangerousCells(const AttackBatch *batch, int lane, Board *b)
+{
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            Mask bit = BIT(SQ(x, y));
+            b->cells[y][x].is_dangerous[black] = (batch->attacks[white][lane] & bit) != 0;
+            b->cells[y][x].is_dangerous[white] = (batch->attacks[black][lane] & bit) != 0;
+        }
+    }
+}
+
+static inline Mask shiftMask(Mask m, int shift)
+{
+    return (shift > 0) ? m << shift : m >> -shift;
+}
+
+static inline Mask shiftStep(Mask m, Step s)
+{
+    return shiftMask(m, s.shift) & s.wrap;
+}
+
+// Kogge-Stone occluded fill: cells reached by sliding from gen over empty
+// cells, plus the first blocker
+static inline Mask slideAttacks(Mask gen, Mask empty, Step s)
+{
+    Mask pro = empty & s.wrap;
+    gen |= pro & shiftMask(gen, s.shift);
+    pro &= shiftMask(pro, s.shift);
+    gen |= pro & shiftMask(gen, 2 * s.shift);
+    pro &= shiftMask(pro, 2 * s.shift);
+    gen |= pro & shiftMask(gen, 4 * s.shift);
+    return shiftStep(gen, s);
+}
+
+static Mask colorAttacksScalar(const AttackBatch *batch, enum PieceColor c, int lane)
+{
+    Mask empty = ~batch->occupied[lane];
+    Mask queens = batch->pieces[c][queen][lane];
+    Mask orthogonal = batch->pieces[c][rook][lane] | queens;
+    Mask diagonal = batch->pieces[c][bishop][lane] | queens;
+    Mask knights = batch->pieces[c][knight][lane];
+    Mask kings = batch->pieces[c][king][lane];
+    Mask pawns = batch->pieces[c][pawn][lane];
+    Mask attacks = 0;
+
+    for (int k = 0; k < 4; k++)
+        attacks |= slideAttacks(orthogonal, empty, slides[k]);
+    for (int k = 4; k < 8; k++)
+        attacks |= slideAttacks(diagonal, empty, slides[k]);
+    for (int k = 0; k < 8; k++) {
+        attacks |= shiftStep(knights, jumps[k]);
+        attacks |= shiftStep(kings, slides[k]);
+    }
+    attacks |= shiftStep(pawns, pawn_captures[c][0]);
+    attacks |= shiftStep(pawns, pawn_captures[c][1]);
+    return attacks;
+}
+
+void computeAttacksScalar(AttackBatch *batches, int count)
+{
+    for (int i = 0; i < count; i++) {
+        for (int lane = 0; lane < ATTACK_BATCH_LANES; lane++) {
+            batches[i].attacks[black][lane] = colorAttacksScalar(&batches[i], black, lane);
+            batches[i].attacks[white][lane] = colorAttacksScalar(&batches[i], white, lane);
+        }
+    }
+}
+
+#ifdef ATTACKS_HAVE_AVX2
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i shift256(__m256i m, int shift)
+{
+    if (shift > 0)
+        return _mm256_sll_epi64(m, _mm_cvtsi32_si128(shift));
+    return _mm256_srl_epi64(m, _mm_cvtsi32_si128(-shift));
+}
+
+AVX2 static inline __m256i step256(__m256i m, Step s)
+{
+    return _mm256_and_si256(shift256(m, s.shift), _mm256_set1_epi64x(s.wrap));
+}
+
+AVX2 static inline __m256i slide256(__m256i gen, __m256i empty, Step s)
+{
+    __m256i pro = _mm256_and_si256(empty, _mm256_set1_epi64x(s.wrap));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift256(gen, s.shift)));
+    pro = _mm256_and_si256(pro, shift256(pro, s.shift));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift256(gen, 2 * s.shift)));
+    pro = _mm256_and_si256(pro, shift256(pro, 2 * s.shift));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift256(gen, 4 * s.shift)));
+    return step256(gen, s);
+}
+
+#define LOAD256(p) _mm256_loadu_si256((const __m256i *)(p))
+
+// Same as colorAttacksScalar, for all four lanes at once
+AVX2 static __m256i colorAttacks256(const AttackBatch *batch, enum PieceColor c)
+{
+    __m256i empty = _mm256_xor_si256(LOAD256(batch->occupied), _mm256_set1_epi64x(-1));
+    __m256i queens = LOAD256(batch->pieces[c][queen]);
+    __m256i orthogonal = _mm256_or_si256(LOAD256(batch->pieces[c][rook]), queens);
+    __m256i diagonal = _mm256_or_si256(LOAD256(batch->pieces[c][bishop]), queens);
+    __m256i knights = LOAD256(batch->pieces[c][knight]);
+    __m256i kings = LOAD256(batch->pieces[c][king]);
+    __m256i pawns = LOAD256(batch->pieces[c][pawn]);
+    __m256i attacks = _mm256_setzero_si256();
+
+    for (int k = 0; k < 4; k++)
+        attacks = _mm256_or_si256(attacks, slide256(orthogonal, empty, slides[k]));
+    for (int k = 4; k < 8; k++)
+        attacks = _mm256_or_si256(attacks, slide256(diagonal, empty, slides[k]));
+    for (int k = 0; k < 8; k++) {
+        attacks = _mm256_or_si256(attacks, step256(knights, jumps[k]));
+        attacks = _mm256_or_si256(attacks, step256(kings, slides[k]));
+    }
+    attacks = _mm256_or_si256(attacks, step256(pawns, pawn_captures[c][0]));
+    attacks = _mm256_or_si256(attacks, step256(pawns, pawn_captures[c][1]));
+    return attacks;
+}
+
+AVX2 static void computeAttacksAVX2(AttackBatch *batches, int count)
+{
+    for (int i = 0; i < count; i++) {
+        __m256i b = colorAttacks256(&batches[i], black);
+        __m256i w = colorAttacks256(&batches[i], white);
+        _mm256_storeu_si256((__m256i *)batches[i].attacks[black], b);
+        _mm256_storeu_si256((__m256i *)batches[i].attacks[white], w);
+    }
+}
+
+#endif // ATTACKS_HAVE_AVX2
+
+// Fills attacks of every lane in every batch, using AVX2 when the cpu has it
+void computeAttacks(AttackBatch *batches, int count)
+{
+#ifdef ATTACKS_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        computeAttacksAVX2(batches, count);
+        return;
+    }
+#endif
+    computeAttacksScalar(batches, count);
+}
+
+#ifdef ATTACKS_HAVE_PLANES
+
+// Byte planes: one byte per cell in cell numbering, 0xff where set. Same
+// fills as above, but on the 8x8 cells rather than on masks. A plane is
+// eight rows of eight bytes, so moving along a row shifts each row lane and
+// drops cells past its ends, while moving across rows shuffles whole lanes.
+// Vectors are generic, the kernel is inlined into an SSE2 function working
+// on pairs of rows and into an AVX2 one working on four rows at a time
+typedef uint64_t Pairs __attribute__((vector_size(16)));
+typedef uint8_t PairBytes __attribute__((vector_size(16)));
+typedef uint64_t Quads __attribute__((vector_size(32)));
+typedef uint8_t QuadBytes __attribute__((vector_size(32)));
+
+typedef union {
+    Pairs v[4];     // rows 0-1, 2-3, 4-5, 6-7
+    Quads w[2];     // rows 0-3, 4-7
+    uint8_t cells[64];
+} Plane;
+
+// Helpers take planes by pointer, so the SSE2 and AVX2 functions pass them
+// the same way, and a constant wide that picks the four row vectors
+#define PLANE_INLINE static inline __attribute__((always_inline))
+
+PLANE_INLINE Plane planeOr(const Plane *a, const Plane *b, bool wide)
+{
+    Plane r;
+    if (wide) {
+        for (int i = 0; i < 2; i++)
+            r.w[i] = a->w[i] | b->w[i];
+    }
+    else {
+        for (int i = 0; i < 4; i++)
+            r.v[i] = a->v[i] | b->v[i];
+    }
+    return r;
+}
+
+PLANE_INLINE Plane planeAnd(const Plane *a, const Plane *b, bool wide)
+{
+    Plane r;
+    if (wide) {
+        for (int i = 0; i < 2; i++)
+            r.w[i] = a->w[i] & b->w[i];
+    }
+    else {
+        for (int i = 0; i < 4; i++)
+            r.v[i] = a->v[i] & b->v[i];
+    }
+    return r;
+}
+
+// Cells whose byte in codes equals code
+PLANE_INLINE Plane planeEqual(const Plane *codes, uint8_t code, bool wide)
+{
+    Plane r;
+    if (wide) {
+        QuadBytes c = {0};
+        c += code;
+        for (int i = 0; i < 2; i++)
+            r.w[i] = (Quads)((QuadBytes)codes->w[i] == c);
+    }
+    else {
+        PairBytes c = {0};
+        c += code;
+        for (int i = 0; i < 4; i++)
+            r.v[i] = (Pairs)((PairBytes)codes->v[i] == c);
+    }
+    return r;
+}
+
+// Moves every row dy rows along, up to 4, on pairs of rows. Even distances
+// move whole pairs, odd ones take a row from each of two neighbouring pairs
+PLANE_INLINE Plane pairRows(const Plane *p, int dy)
+{
+    const Pairs none = {0};
+    const Pairs pairs[8] = {none, none, p->v[0], p->v[1], p->v[2], p->v[3], none, none};
+    Plane r;
+    for (int i = 0; i < 4; i++) {
+        if (dy % 2 == 0) {
+            r.v[i] = pairs[2 + i - dy / 2];
+        }
+        else {
+            int first = 2 + i - (dy + 1) / 2;   // pair holding row 2 * i - dy
+            r.v[i] = __builtin_shufflevector(pairs[first], pairs[first + 1], 1, 2);
+        }
+    }
+    return r;
+}
+
+// Four consecutive rows out of a followed by b
+#define QUAD_FROM(a, b, first) \
+    __builtin_shufflevector(a, b, (first), (first) + 1, (first) + 2, (first) + 3)
+
+#define QUADS_DOWN(d) \
+    case d: \
+        return (Plane){.w = {QUAD_FROM(none, p->w[0], 4 - d), QUAD_FROM(p->w[0], p->w[1], 4 - d)}}
+
+#define QUADS_UP(d) \
+    case -d: \
+        return (Plane){.w = {QUAD_FROM(p->w[0], p->w[1], d), QUAD_FROM(p->w[1], none, d)}}
+
+// Same as pairRows on four rows at a time. Shuffle indices have to be
+// constants, so each distance gets its own case
+PLANE_INLINE Plane quadRows(const Plane *p, int dy)
+{
+    const Quads none = {0};
+    switch (dy) {
+    QUADS_DOWN(1);
+    QUADS_DOWN(2);
+    QUADS_DOWN(4);
+    QUADS_UP(1);
+    QUADS_UP(2);
+    QUADS_UP(4);
+    default:
+        return *p;
+    }
+}
+
+// Moves every cell dx files and dy rows along, as shiftMask does with bits
+// but without wrapping around the edges. Cells moved in are empty
+PLANE_INLINE Plane planeShift(const Plane *p, int dx, int dy, bool wide)
+{
+    Plane r;
+    if (wide) {
+        r = quadRows(p, dy);
+        for (int i = 0; i < 2; i++) {
+            if (dx > 0)
+                r.w[i] <<= 8 * dx;
+            else if (dx < 0)
+                r.w[i] >>= -8 * dx;
+        }
+    }
+    else {
+        r = pairRows(p, dy);
+        for (int i = 0; i < 4; i++) {
+            if (dx > 0)
+                r.v[i] <<= 8 * dx;
+            else if (dx < 0)
+                r.v[i] >>= -8 * dx;
+        }
+    }
+    return r;
+}
+
+// Ors the cells reached by one step from p into attacks
+PLANE_INLINE void addStep(Plane *attacks, const Plane *p, int dx, int dy, bool wide)
+{
+    Plane moved = planeShift(p, dx, dy, wide);
+    *attacks = planeOr(attacks, &moved, wide);
+}
+
+// Kogge-Stone occluded fill, the same as slideAttacks, ored into attacks.
+// Shifts don't wrap, so empty cells need no edge masks
+PLANE_INLINE void addSlide(Plane *attacks, const Plane *sliders, const Plane *empty,
+                           int dx, int dy, bool wide)
+{
+    Plane gen = *sliders;
+    Plane pro = *empty;
+    Plane t;
+
+    t = planeShift(&gen, dx, dy, wide);
+    t = planeAnd(&pro, &t, wide);
+    gen = planeOr(&gen, &t, wide);
+    t = planeShift(&pro, dx, dy, wide);
+    pro = planeAnd(&pro, &t, wide);
+    t = planeShift(&gen, 2 * dx, 2 * dy, wide);
+    t = planeAnd(&pro, &t, wide);
+    gen = planeOr(&gen, &t, wide);
+    t = planeShift(&pro, 2 * dx, 2 * dy, wide);
+    pro = planeAnd(&pro, &t, wide);
+    t = planeShift(&gen, 4 * dx, 4 * dy, wide);
+    t = planeAnd(&pro, &t, wide);
+    gen = planeOr(&gen, &t, wide);
+    addStep(attacks, &gen, dx, dy, wide);
+}
+
+// Piece codes of plane cells, 0 for empty cells. One above PIECE_CODE of
+// position.h, whose codes start at 0
+#define PLANE_CODE(color, type) ((color) * 8 + (type) + 1)
+
+// Steps are spelled out so that every shift distance is a constant
+PLANE_INLINE Plane colorAttacksPlane(const Plane *codes, const Plane *empty,
+                                     enum PieceColor c, bool wide)
+{
+    Plane queens = planeEqual(codes, PLANE_CODE(c, queen), wide);
+    Plane rooks = planeEqual(codes, PLANE_CODE(c, rook), wide);
+    Plane bishops = planeEqual(codes, PLANE_CODE(c, bishop), wide);
+    Plane knights = planeEqual(codes, PLANE_CODE(c, knight), wide);
+    Plane kings = planeEqual(codes, PLANE_CODE(c, king), wide);
+    Plane pawns = planeEqual(codes, PLANE_CODE(c, pawn), wide);
+    Plane orthogonal = planeOr(&rooks, &queens, wide);
+    Plane diagonal = planeOr(&bishops, &queens, wide);
+    Plane attacks = {0};
+
+    addSlide(&attacks, &orthogonal, empty, 1, 0, wide);
+    addSlide(&attacks, &orthogonal, empty, -1, 0, wide);
+    addSlide(&attacks, &orthogonal, empty, 0, 1, wide);
+    addSlide(&attacks, &orthogonal, empty, 0, -1, wide);
+    addSlide(&attacks, &diagonal, empty, 1, 1, wide);
+    addSlide(&attacks, &diagonal, empty, -1, 1, wide);
+    addSlide(&attacks, &diagonal, empty, 1, -1, wide);
+    addSlide(&attacks, &diagonal, empty, -1, -1, wide);
+
+    addStep(&attacks, &knights, 1, 2, wide);
+    addStep(&attacks, &knights, -1, 2, wide);
+    addStep(&attacks, &knights, 1, -2, wide);
+    addStep(&attacks, &knights, -1, -2, wide);
+    addStep(&attacks, &knights, 2, 1, wide);
+    addStep(&attacks, &knights, -2, 1, wide);
+    addStep(&attacks, &knights, 2, -1, wide);
+    addStep(&attacks, &knights, -2, -1, wide);
+
+    for (int dy = -1; dy <= 1; dy++)
+        for (int dx = -1; dx <= 1; dx++)
+            if (dx || dy)
+                addStep(&attacks, &kings, dx, dy, wide);
+
+    // Black pawns capture downwards, white pawns upwards
+    int forward = (c == black) ? 1 : -1;
+    addStep(&attacks, &pawns, -1, forward, wide);
+    addStep(&attacks, &pawns, 1, forward, wide);
+    return attacks;
+}
+
+PLANE_INLINE void dangerPlanes(const Plane *codes, Plane attacks[2], bool wide)
+{
+    Plane empty = planeEqual(codes, 0, wide);
+    attacks[black] = colorAttacksPlane(codes, &empty, black, wide);
+    attacks[white] = colorAttacksPlane(codes, &empty, white, wide);
+}
+
+static void dangerPlanesSSE2(const Plane *codes, Plane attacks[2])
+{
+    dangerPlanes(codes, attacks, false);
+}
+
+#ifdef ATTACKS_HAVE_AVX2
+AVX2 static void dangerPlanesAVX2(const Plane *codes, Plane attacks[2])
+{
+    dangerPlanes(codes, attacks, true);
+}
+#endif
+
+// Marks cells attacked by one color as dangerous for the other, the same as
+// recordDangerousCells does walking each piece. Pieces are mirrored into a
+// plane of piece codes, split into a plane per piece kind by compares
+void storeDangerousCellsByPlanes(Board *restrict b)
+{
+    Plane codes;
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            Piece p = b->cells[y][x].piece;
+            bool empty = p.type == no_type || p.color == no_color;
+            codes.cells[SQ(x, y)] = empty ? 0 : PLANE_CODE(p.color, p.type);
+        }
+    }
+
+    Plane attacks[2];
+#ifdef ATTACKS_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        dangerPlanesAVX2(&codes, attacks);
+    else
+#endif
+        dangerPlanesSSE2(&codes, attacks);
+
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            b->cells[y][x].is_dangerous[black] = attacks[white].cells[SQ(x, y)] != 0;
+            b->cells[y][x].is_dangerous[white] = attacks[black].cells[SQ(x, y)] != 0;
+        }
+    }
+}
+
+#undef PLANE_CODE
+
+#endif // ATTACKS_HAVE_PLANES
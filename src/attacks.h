@@ -0,0 +1,31 @@
+#ifndef ATTACKS_H
+#define ATTACKS_H
+
+#include "declarations.h"
+
+#define ATTACK_BATCH_LANES 4
+
+// Danger maps from byte planes need vector shuffles of clang or gcc 12, and
+// run on SSE2 or AVX2. Elsewhere recordDangerousCells walks each piece
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 12)
+#define ATTACKS_HAVE_PLANES
+#endif
+
+// Up to four independent positions laid out as structure of arrays,
+// so one AVX2 register holds the same mask of every lane
+typedef struct {
+    Mask pieces[2][6][ATTACK_BATCH_LANES];
+    Mask occupied[ATTACK_BATCH_LANES];
+    Mask attacks[2][ATTACK_BATCH_LANES];    // cells attacked by each color
+} AttackBatch;
+
+void loadAttackBatchLane(AttackBatch *batch, int lane, const Board *b);
+void clearAttackBatchLane(AttackBatch *batch, int lane);
+void computeAttacks(AttackBatch *batches, int count);
+void computeAttacksScalar(AttackBatch *batches, int count);
+void storeDangerousCells(const AttackBatch *batch, int lane, Board *b);
+#ifdef ATTACKS_HAVE_PLANES
+void storeDangerousCellsByPlanes(Board *restrict b);
+#endif
+
+#endif // ATTACKS_H
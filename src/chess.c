@@ -1,23 +1,153 @@
+#include <math.h>
 #include <raylib.h>
 #include <stdio.h>
 
 #include "declarations.h"
 #include "colorizers.h"
+#include "engine.h"
 #include "handlers.h"
+#include "masks.h"
+#include "memo.h"
+#include "successors.h"
 #include "tools.h"
 
+#ifdef VERIFY_LEGAL_MOVES
+#include "workers.h"
+#endif
+
 Sound sounds[2];
 
+// Time the computer gets for a move, on top of pondering on the player's
+#define COMPUTER_MOVE_MILLIS 1000
+
+// Search time a hint gets each time H is pressed
+#define HINT_MILLIS 500
+
+// Width of the analysis panel, right of the board
+#define PANEL_WIDTH 260
+
+// Candidate moves drawn as arrows while analysing, set with keys 1 to 5
+#define ANALYSIS_LINES      3
+#define MAX_ANALYSIS_LINES  5
+
+static void scoreText(int score, char *text)
+{
+    if (mateIn(score) != 0)
+        sprintf(text, "mate %d", mateIn(score));
+    else
+        sprintf(text, "%+.2f", score / 100.0);
+}
+
+// Best line and score of the analysis so far, in the panel right of the board
+static void drawAnalysis(const Board *b, int threads, const SearchReport *r)
+{
+    int x = WINDOW_SIZE;
+    int y = BOARD_PADDING;
+    char text[128];
+
+    sprintf(text, "Analysis on %d threads", threads);
+    DrawText(text, x, y, 20, COLOR_WHITE);
+    if (r == NULL || r->depth == 0)
+        return;
+
+    // Scores are for the side to move, shown for white as usual
+    char score[16];
+    scoreText(b->turn == white ? r->score : -r->score, score);
+    sprintf(text, "Depth %d, score %s", r->depth, score);
+    DrawText(text, x, y += 30, 20, COLOR_WHITE);
+    sprintf(text, "%ld nodes, %ld knps", r->nodes, nodesPerSecond(r) / 1000);
+    DrawText(text, x, y += 25, 10, COLOR_WHITE);
+
+    // Best line, a few moves per row
+    y += 15;
+    int shown = 0;
+    for (int i = 0; i < r->pv_length; i++) {
+        char move[6];
+        moveText(r->pv[i], move);
+        int width = MeasureText(move, 20) + 10;
+        if (shown + width > PANEL_WIDTH - BOARD_PADDING) {
+            y += 25;
+            shown = 0;
+        }
+        DrawText(move, x + shown, y, 20, COLOR_WHITE);
+        shown += width;
+    }
+
+    // Every candidate with its score
+    y += 40;
+    for (int i = 0; i < r->candidate_count; i++) {
+        char move[6];
+        moveText(r->candidates[i].move, move);
+        scoreText(b->turn == white ? r->candidates[i].score : -r->candidates[i].score, score);
+        sprintf(text, "%d. %s %s", i + 1, move, score);
+        DrawText(text, x, y + i * 25, 20, COLOR_WHITE);
+    }
+}
+
+// Arrows from and to the cells of the candidate moves, best one thickest,
+// scored at the head
+static void drawCandidates(const Board *b, const SearchReport *r)
+{
+    for (int i = r->candidate_count - 1; i >= 0; i--) {
+        SearchMove m = r->candidates[i].move;
+        V2 from = cellPosByIdx(SQ_X(m.from), SQ_Y(m.from));
+        V2 to = cellPosByIdx(SQ_X(m.to), SQ_Y(m.to));
+        Vector2 tail = {from.x + CELL_SIZE / 2.0f, from.y + CELL_SIZE / 2.0f};
+        Vector2 tip = {to.x + CELL_SIZE / 2.0f, to.y + CELL_SIZE / 2.0f};
+
+        // Unit vector along the arrow, and across it
+        float dx = tip.x - tail.x;
+        float dy = tip.y - tail.y;
+        float length = sqrtf(dx * dx + dy * dy);
+        dx /= length;
+        dy /= length;
+
+        float thickness = (i == 0) ? 12 : 7;
+        float head = thickness * 2;
+        Vector2 neck = {tip.x - dx * head, tip.y - dy * head};
+        Vector2 left = {neck.x + dy * head * 0.8f, neck.y - dx * head * 0.8f};
+        Vector2 right = {neck.x - dy * head * 0.8f, neck.y + dx * head * 0.8f};
+        DrawLineEx(tail, neck, thickness, COLOR_CANDIDATE);
+        DrawTriangle(tip, left, right, COLOR_CANDIDATE);
+
+        char score[16];
+        scoreText(b->turn == white ? r->candidates[i].score : -r->candidates[i].score, score);
+        int width = MeasureText(score, 10);
+        DrawRectangle(tip.x - width / 2 - 2, tip.y - 7, width + 4, 14, COLOR_BLACK);
+        DrawText(score, tip.x - width / 2, tip.y - 5, 10, COLOR_WHITE);
+    }
+}
+
 int main(void)
 {
     InitWindow(WINDOW_SIZE, WINDOW_SIZE, "Chess");
     InitAudioDevice();
     SetTargetFPS(60);
+#ifdef VERIFY_LEGAL_MOVES
+    // Only the full recomputation of moves simulates them across the pool
+    startWorkers(suggestedWorkerCount());
+#endif
+    startSuccessors(suggestedWorkerCount());
+    startEngine();
 
     Board board = initBoard();
+    BoardView view = initBoardView(&board);
+    speculateSuccessors(&board);
     PromotionWindow pwin = initPromotionWindow();
     bool draw_debug_hints = false;
 
+    // Side played by the computer, and the move count it was last asked about
+    enum PieceColor computer = no_color;
+    int requested = -1;
+
+    // Analysis of the position on screen, on a thread per core
+    bool analysing = false;
+    int analysis_threads = suggestedWorkerCount() + 1;
+    int analysis_lines = ANALYSIS_LINES;
+
+    // Move count of the position a hint was asked for, -1 for none
+    int hint_for = -1;
+
     // Load piece textures
     // In order with enums for indexing
     int icon_diff = 14;
@@ -44,58 +174,167 @@ int main(void)
         BeginDrawing();
         ClearBackground(COLOR_BLACK);
 
-        // Take mouse inputs when game is running
-        if (!board.checkmate && IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+        // Take mouse inputs when game is running and it's the player's turn
+        bool players_turn = board.turn != computer || board.promotion_pending;
+        if (!board.checkmate && players_turn && IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+            // The analysis panel widens the window past the board
+            V2 ti = cellIdxByPos(GetMouseX(), GetMouseY());
+            bool on_board = GetMouseX() >= BOARD_PADDING && GetMouseY() >= BOARD_PADDING;
             if (board.promotion_pending)
-                handlePromotion(GetMouseX(), GetMouseY(), &board, pwin);
+                handlePromotion(GetMouseX(), GetMouseY(), &board, &view, pwin);
+            else if (on_board && validCellIdx(ti.x, ti.y))
+                handleTouch(GetMouseX(), GetMouseY(), &board, &view);
+        }
+
+        // A new game or toggling the computer leaves analysis
+        bool leave_analysis = IsKeyPressed(KEY_R) || IsKeyPressed(KEY_N) || IsKeyPressed(KEY_C);
+        if ((leave_analysis && analysing) || IsKeyPressed(KEY_A)) {
+            analysing = !analysing;
+            requested = -1;
+            SetWindowSize(WINDOW_SIZE + (analysing ? PANEL_WIDTH : 0), WINDOW_SIZE);
+            if (analysing)
+                computer = no_color;
             else
-                handleTouch(GetMouseX(), GetMouseY(), &board);
+                haltEngine();
+        }
+
+        for (int lines = 1; lines <= MAX_ANALYSIS_LINES; lines++) {
+            if (analysing && IsKeyPressed(KEY_ZERO + lines) && lines != analysis_lines) {
+                analysis_lines = lines;
+                requested = -1;
+            }
         }
 
         if (IsKeyPressed(KEY_R)) {
             board = initBoard();
+            view = initBoardView(&board);
+            speculateSuccessors(&board);
+            requested = -1;
+            hint_for = -1;
+        }
+
+        if (IsKeyPressed(KEY_N)) {
+            board = initBoard960(GetRandomValue(0, 959));
+            view = initBoardView(&board);
+            speculateSuccessors(&board);
+            requested = -1;
+            hint_for = -1;
+        }
+
+        // Computer takes the side not to move, or leaves the game
+        if (IsKeyPressed(KEY_C)) {
+            computer = (computer != no_color) ? no_color : (board.turn == white) ? black : white;
+            requested = -1;
+            if (computer == no_color)
+                haltEngine();
         }
 
+        // Computer thinks on its turn and ponders on the player's, asked
+        // once per position. Analysis starts over on every move
+        bool engine_used = computer != no_color || analysing;
+        if (engine_used && !board.promotion_pending && requested != (int)board.move_count) {
+            requested = board.move_count;
+            if (gameOver(&board))
+                haltEngine();
+            else if (analysing)
+                analyze(&board, analysis_threads, analysis_lines);
+            else if (board.turn == computer)
+                thinkAbout(&board, COMPUTER_MOVE_MILLIS);
+            else
+                ponderOn(&board);
+        }
+
+        // Hints come from the search on the player's position when the
+        // computer ponders or analysis runs, otherwise from one of their own
+        // that each press searches deeper
+        bool hintable = board.turn != computer && !board.promotion_pending && !gameOver(&board);
+        if (IsKeyPressed(KEY_H) && hintable) {
+            hint_for = board.move_count;
+            if (!engine_used)
+                hint(&board, HINT_MILLIS);
+        }
+
+        // The hint shows as soon as the first depth is searched, until a move
+        SearchReport hint_report;
+        bool pondering;
+        bool hinting = hintable && hint_for == (int)board.move_count && engineReport(&hint_report, &pondering) &&
+                       hint_report.best.from != hint_report.best.to;
+
+        SearchMove reply;
+        if (computer == board.turn && takeEngineMove(&board, &reply))
+            handleComputerMove(&board, &view, reply);
+
         if (IsKeyPressed(KEY_F)) {
-            generateFEN(board);
+            generateFEN(&board);
         }
 
         // Draw board and pieces
         for (int y = 0; y < 8; y++) {
             for (int x = 0; x < 8; x++) {
                 Cell c = board.cells[y][x];
-                DrawRectangle(c.pos.x, c.pos.y, CELL_SIZE, CELL_SIZE, c.bg);
+                CellView cv = view.cells[y][x];
+                Color bg = cv.bg;
+                if (hinting && SQ(x, y) == hint_report.best.from)
+                    bg = tintCell((V2){x, y}, COLOR_MOVE_SRC);
+                else if (hinting && SQ(x, y) == hint_report.best.to)
+                    bg = tintCell((V2){x, y}, COLOR_MOVE_DST);
+                DrawRectangle(cv.pos.x, cv.pos.y, CELL_SIZE, CELL_SIZE, bg);
 
                 if (draw_debug_hints) {
                     char idx[4];
                     sprintf(idx, "%d%d", y, x);
-                    DrawText(idx, c.pos.x, c.pos.y, 10, BLUE);
+                    DrawText(idx, cv.pos.x, cv.pos.y, 10, BLUE);
 
-                    int bottom_y = c.pos.y + 70;
+                    int bottom_y = cv.pos.y + 70;
                     if (c.is_dangerous[white])
-                        DrawText("D", c.pos.x + 5, bottom_y, 10, RED);
+                        DrawText("D", cv.pos.x + 5, bottom_y, 10, RED);
                     if (c.is_dangerous[black])
-                        DrawText("d", c.pos.x + 15, bottom_y, 10, RED);
-                    if (c.blocks_check)
-                        DrawText("bc", c.pos.x + 30, bottom_y, 10, BLACK);
-                    if (c.opens_check)
-                        DrawText("pin", c.pos.x + 45, bottom_y, 10, BLACK);
+                        DrawText("d", cv.pos.x + 15, bottom_y, 10, RED);
+                    bool movable = c.piece.color == board.turn && board.legal_moves[SQ(x, y)];
+                    if (board.king_checked && movable && c.piece.type != king)
+                        DrawText("bc", cv.pos.x + 30, bottom_y, 10, BLACK);
+                    if (board.pinned & BIT(SQ(x, y)))
+                        DrawText("pin", cv.pos.x + 45, bottom_y, 10, BLACK);
                     if (board.has_en_passant_target &&
                         y == board.en_passant_target_idx.y &&
                         x == board.en_passant_target_idx.x)
-                        DrawText("ep", c.pos.x + 60, bottom_y, 10, BLACK);
+                        DrawText("ep", cv.pos.x + 60, bottom_y, 10, BLACK);
                 }
 
-                if (emptyCell(c))
+                if (emptyCell(&c))
                     continue;
 
                 // Draw textures of chess pieces
                 DrawTexture(piece_textures[c.piece.color][c.piece.type],
-                            c.pos.x + icon_diff / 2, c.pos.y + icon_diff / 2,
+                            cv.pos.x + icon_diff / 2, cv.pos.y + icon_diff / 2,
                             COLOR_WHITE);
             }
         }
 
+        // Outline the hovered cell if moving there gives check
+        if (board.move_pending) {
+            V2 hi = cellIdxByPos(GetMouseX(), GetMouseY());
+            bool on_board = GetMouseX() >= BOARD_PADDING && GetMouseY() >= BOARD_PADDING;
+            if (on_board && validCellIdx(hi.x, hi.y)) {
+                Cell *hovered = &board.cells[hi.y][hi.x];
+                Move m = {.src = board.active_cell, .dst = hovered};
+                if (view.cells[hi.y][hi.x].is_movable && givesCheck(&board, m)) {
+                    V2 pos = view.cells[hi.y][hi.x].pos;
+                    Rectangle r = {pos.x, pos.y, CELL_SIZE, CELL_SIZE};
+                    DrawRectangleLinesEx(r, 3, COLOR_CELL_CHECKING);
+                }
+            }
+        }
+
+        // Analysis of the position on screen only, a move clears it until
+        // the search of the next one reports
+        SearchReport analysis;
+        bool have_analysis = analysing && !board.promotion_pending && engineReport(&analysis, &pondering);
+        if (have_analysis)
+            drawCandidates(&board, &analysis);
+        if (analysing)
+            drawAnalysis(&board, analysis_threads, have_analysis ? &analysis : NULL);
+
         // Draw a window to select promoted piece if promotion is pending
         if (board.promotion_pending) {
             enum PieceColor promoting_color = board.promoting_cell->piece.color;
@@ -127,16 +366,32 @@ int main(void)
         }
 
         // Show draw during draw
-        bool drawn = board.draw_by_fifty_move || board.draw_by_stalemate;
+        bool drawn = board.draw_by_fifty_move || board.draw_by_stalemate ||
+                     board.draw_by_repetition || board.draw_by_insufficient_material;
         if (drawn) {
             int size = 50;
-            char *text = board.draw_by_fifty_move  ? "Draw (fifty move rule)"
-                         : board.draw_by_stalemate ? "Draw (stalemate)"
-                                                   : "Draw";
+            char *text = board.draw_by_fifty_move              ? "Draw (fifty move rule)"
+                         : board.draw_by_stalemate             ? "Draw (stalemate)"
+                         : board.draw_by_repetition            ? "Draw (repetition)"
+                         : board.draw_by_insufficient_material ? "Draw (material)"
+                                                               : "Draw";
             int width = MeasureText(text, size);
             DrawText(text, BOARD_SIZE / 2 - width / 2, BOARD_SIZE / 2 - size / 2, size, BLUE);
         }
 
+        // Search progress of the computer, in the padding above the board
+        SearchReport report;
+        if (computer != no_color && engineReport(&report, &pondering)) {
+            char score_text[16];
+            scoreText(pondering ? -report.score : report.score, score_text);
+
+            char info[128];
+            sprintf(info, "Computer %s: depth %d, score %s, %ld nodes, %ld knps",
+                    pondering ? "pondering" : "thinking", report.depth, score_text,
+                    report.nodes, nodesPerSecond(&report) / 1000);
+            DrawText(info, BOARD_PADDING, 0, 10, COLOR_WHITE);
+        }
+
         EndDrawing();
     }
 
@@ -151,6 +406,17 @@ int main(void)
     UnloadSound(sounds[move_sound]);
     UnloadSound(sounds[capture_sound]);
 
+    stopEngine();
+    stopSuccessors();
+#ifdef VERIFY_LEGAL_MOVES
+    stopWorkers();
+#endif
+
+    long hits, lookups;
+    memoStats(&hits, &lookups);
+    printf("Memoized positions: %ld hits of %ld lookups (%.1f%%)\n", hits, lookups,
+           lookups ? 100.0 * hits / lookups : 0.0);
+
     CloseAudioDevice();
     CloseWindow();
 }
@@ -1,74 +1,102 @@
 #include "colorizers.h"
+#include "masks.h"
 #include "tools.h"
 
 Color checkers[2] = {COLOR_CHECKER_DARK, COLOR_CHECKER_LIGHT};
 
-void resetCellBackgrounds(Board *b)
+// Lays out the cells and colors them for the given board
+BoardView initBoardView(const Board *b)
+{
+    BoardView v;
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            v.cells[y][x].pos = cellPosByIdx(x, y);
+            v.cells[y][x].is_movable = false;
+        }
+    }
+
+    resetCellBackgrounds(&v);
+    colorLastMove(b, &v);
+    colorKingIfChecked(b, &v);
+    return v;
+}
+
+void resetCellBackgrounds(BoardView *v)
 {
     for (int y = 0; y < 8; y++)
         for (int x = 0; x < 8; x++)
-            b->cells[y][x].bg = checkers[(y + x) % 2];
+            v->cells[y][x].bg = checkers[(y + x) % 2];
 }
 
-void colorMovableCells(const Cell touched, Board *b)
+// Marks and colors the cells the touched piece can move to, from its
+// recorded legal moves
+void colorMovableCells(const Cell *touched, const Board *b, BoardView *v)
 {
-    enum PieceColor tcolor = touched.piece.color;
+    enum PieceColor tcolor = touched->piece.color;
+    Mask legal = b->legal_moves[cellSq(touched)];
     for (int i = 0; i < 8; i++) {
         for (int j = 0; j < 8; j++) {
-            Cell *cell = &(b->cells[i][j]);
-            if (!cell->is_movable)
+            const Cell *cell = &(b->cells[i][j]);
+            v->cells[i][j].is_movable = (legal & BIT(SQ(j, i))) != 0;
+            if (!v->cells[i][j].is_movable)
                 continue;
 
-            Color newbg = !emptyCell(*cell) ? COLOR_CELL_CAPTURABLE : COLOR_CELL_MOVABLE;
-            if (cell == b->queenside_castling_cell[tcolor] || cell == b->kingside_castling_cell[tcolor])
+            Color newbg = !emptyCell(cell) ? COLOR_CELL_CAPTURABLE : COLOR_CELL_MOVABLE;
+            if (cell == b->castling_cells[tcolor][queenside] || cell == b->castling_cells[tcolor][kingside])
                 newbg = COLOR_CELL_CASTLING;
 
-            recolorCell(cell, newbg);
+            recolorCell(v, cell->idx, newbg);
         }
     }
 }
 
-void colorKingIfChecked(Board *b)
+void colorKingIfChecked(const Board *b, BoardView *v)
 {
     if (b->king_checked)
-        recolorCell(b->checked_king, COLOR_CELL_CAPTURABLE);
+        recolorCell(v, b->checked_king->idx, COLOR_CELL_CAPTURABLE);
 }
 
-void decolorKingIfChecked(Board *b)
+void decolorKingIfChecked(const Board *b, BoardView *v)
 {
     if (b->king_checked) {
-        Cell *ck = b->checked_king;
-        ck->bg = checkers[(ck->idx.y + ck->idx.x) % 2];
+        V2 ki = b->checked_king->idx;
+        v->cells[ki.y][ki.x].bg = checkers[(ki.y + ki.x) % 2];
     }
 }
 
-void colorLastMove(Board *b)
+void colorLastMove(const Board *b, BoardView *v)
 {
     if (b->move_count == 0)
         return;
-    recolorCell(b->last_move.src, COLOR_MOVE_SRC);
-    recolorCell(b->last_move.dst, COLOR_MOVE_DST);
+    recolorCell(v, b->last_move.src->idx, COLOR_MOVE_SRC);
+    recolorCell(v, b->last_move.dst->idx, COLOR_MOVE_DST);
 }
 
-void decolorLastMove(Board *b)
+void decolorLastMove(const Board *b, BoardView *v)
 {
     if (b->move_count == 0)
         return;
-    Cell *src = b->last_move.src;
-    Cell *dst = b->last_move.dst;
-    src->bg = checkers[(src->idx.y + src->idx.x) % 2];
-    dst->bg = checkers[(dst->idx.y + dst->idx.x) % 2];
+    V2 si = b->last_move.src->idx;
+    V2 di = b->last_move.dst->idx;
+    v->cells[si.y][si.x].bg = checkers[(si.y + si.x) % 2];
+    v->cells[di.y][di.x].bg = checkers[(di.y + di.x) % 2];
 }
 
 // Applies a color on top of an exisiting background color
-void recolorCell(Cell *cell, Color color)
+void recolorCell(BoardView *v, V2 idx, Color color)
+{
+    v->cells[idx.y][idx.x].bg = tintCell(idx, color);
+}
+
+// The color as applied on top of the checker color of the cell at idx
+Color tintCell(V2 idx, Color color)
 {
-    Color original = checkers[(cell->idx.y + cell->idx.x) % 2];
+    Color original = checkers[(idx.y + idx.x) % 2];
     bool cell_is_dark =
         original.r == COLOR_CHECKER_DARK.r &&
         original.g == COLOR_CHECKER_DARK.g &&
         original.b == COLOR_CHECKER_DARK.b;
 
     color.a = cell_is_dark ? 255 : 200;
-    cell->bg = color;
+    return color;
 }
@@ -1,6 +1,8 @@
 #ifndef COLORS_H
 #define COLORS_H
 
+#include <raylib.h>
+
 #include "declarations.h"
 
 #define COLOR_RED               (Color){0xd7, 0x6c, 0x6c, 0xff}
@@ -12,19 +14,34 @@
 #define COLOR_CELL_MOVABLE      (Color){0x8e, 0xb7, 0xd6, 0xff}
 #define COLOR_CELL_CASTLING     (Color){0x5e, 0x81, 0xac, 0xff}
 #define COLOR_CELL_CAPTURABLE   COLOR_RED
+#define COLOR_CELL_CHECKING     COLOR_RED
 #define COLOR_MOVE_SRC          (Color){0xcb, 0xdd, 0xaf, 0xff}
 #define COLOR_MOVE_DST          COLOR_MOVE_SRC
 #define COLOR_CHECKER_DARK      COLOR_GREY
 #define COLOR_CHECKER_LIGHT     COLOR_WHITE
+#define COLOR_CANDIDATE         (Color){0x50, 0x8a, 0x5b, 0xb0}
+
+// Drawing state of a cell, kept out of Board so rules never copy it
+typedef struct {
+    V2 pos;
+    Color bg;
+    bool is_movable;    // the touched piece can move here
+} CellView;
+
+typedef struct {
+    CellView cells[8][8];
+} BoardView;
 
 extern Color checkers[2];
 
-void resetCellBackgrounds(Board *b);
-void colorMovableCells(const Cell touched, Board *b);
-void colorKingIfChecked(Board *b);
-void colorLastMove(Board *b);
-void recolorCell(Cell *cell, Color color);
-void decolorKingIfChecked(Board *b);
-void decolorLastMove(Board *b);
+BoardView initBoardView(const Board *b);
+void resetCellBackgrounds(BoardView *v);
+void colorMovableCells(const Cell *touched, const Board *b, BoardView *v);
+void colorKingIfChecked(const Board *b, BoardView *v);
+void colorLastMove(const Board *b, BoardView *v);
+void recolorCell(BoardView *v, V2 idx, Color color);
+Color tintCell(V2 idx, Color color);
+void decolorKingIfChecked(const Board *b, BoardView *v);
+void decolorLastMove(const Board *b, BoardView *v);
 
 #endif // COLORS_H
\ No newline at end of file
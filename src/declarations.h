@@ -1,7 +1,8 @@
 #ifndef DECLARATIONS_H
 #define DECLARATIONS_H
 
-#include <raylib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #define CELL_SIZE               80
@@ -9,6 +10,10 @@
 #define BOARD_SIZE              (CELL_SIZE * 8)
 #define WINDOW_SIZE             (BOARD_SIZE + BOARD_PADDING * 2)
 
+// Halfmove clocks a position key is kept for, the fifty move rule ends the
+// game after 100
+#define KEY_HISTORY_SIZE        101
+
 enum PieceColor {
     black,
     white,
@@ -25,28 +30,40 @@ enum PieceType {
     no_type,
 };
 
+enum CastlingSide {
+    queenside,
+    kingside,
+};
+
 typedef struct {
     int x;
     int y;
 } V2;
 
+typedef uint64_t Mask;  // one bit per cell, see masks.h
+
+// Castling right of a color on a side, as a bit of Board.castling_rights
+#define CASTLE_RIGHT(color, side)   (1u << ((color) * 2 + (side)))
+#define ALL_CASTLE_RIGHTS           0xfu
+
 typedef struct {
     enum PieceType type;
     enum PieceColor color;
 } Piece;
 
+// Rules state of a cell, drawing state lives in CellView (colorizers.h)
 typedef struct {
-    V2 pos;
     V2 idx;
-    Color bg;
     Piece piece;
     bool is_dangerous[2];   // dangerous for black or white king
-    bool in_range;
+#ifdef VERIFY_LEGAL_MOVES
+    // Piece state simulated by recordPieceState, to check recorded legal moves
     bool is_movable;
     bool blocks_check;      // Cell can block check
     bool opens_check;       // Check happens if piece on cell moves somewhere (pin)
-    bool check_opening_cells[8][8];     // Moving on one of these will open check
-    bool check_blocking_cells[8][8];    // Moving on one of these will block check
+    Mask check_opening_cells;   // Moving on one of these will open check
+    Mask check_blocking_cells;  // Moving on one of these will block check
+#endif
 } Cell;
 
 typedef struct {
@@ -54,13 +71,22 @@ typedef struct {
     Cell *dst;
 } Move;
 
+typedef struct {
+    int king_from;
+    int king_to;
+    int rook_from;
+    int rook_to;
+    Mask path;      // cells that must be empty, apart from the castling king and rook
+    Mask safe;      // cells the king crosses or lands on, must not be dangerous
+} CastlingRule;
+
 typedef struct {
     Cell cells[8][8];
     Cell *active_cell;
     Cell *checked_king;
     Cell *promoting_cell;
-    Cell *queenside_castling_cell[2];
-    Cell *kingside_castling_cell[2];
+    Cell *castling_cells[2][2];         // by color and side, cell to touch for castling
+    CastlingRule castling_rules[2][2];  // by color and side, used for chess960 only
     Move last_move;
     V2 en_passant_target_idx;
     bool has_en_passant_target;
@@ -70,14 +96,36 @@ typedef struct {
     bool checkmate;
     bool draw_by_fifty_move;
     bool draw_by_stalemate;
+    bool draw_by_repetition;
+    bool draw_by_insufficient_material;
+    bool last_move_captured;
+#ifdef VERIFY_LEGAL_MOVES
     bool filter_nonblocking_cells;      // filter out cells that don't help block check
     bool filter_check_opening;          // filter out cells that open check
-    bool queenside_castle_available[2];
-    bool kingside_castle_available[2];
+#endif
+    bool chess960;
+    unsigned char castling_rights;          // CASTLE_RIGHT bits still held
+    unsigned char castling_rights_kept[64]; // rights left after a move from or to a cell
+    Mask pieces[2][6];                  // cells holding each color and type of piece
+    Mask occupied[2];                   // cells holding each color
+    Mask in_range;                      // cells in range of the piece, see fillCellsInRange
+    Mask check_squares[6];              // cells where a piece type would check opponent king
+    Mask discovered_checkers;           // pieces that uncover a check when moved off line
+    Mask checkers;                      // opponent pieces checking the side to move
+    Mask pinned;                        // pieces of the side to move pinned to their king
+    int opponent_king_sq;
+    int king_sq;
+    Mask legal_moves[64];               // by cell, legal moves of the piece there, see recordLegalMoves
+    Mask moves_changed[2];              // by color, cells changed since its legal moves were recorded
+    Mask moves_checkers[2];             // by color, checkers when its legal moves were recorded
+    Mask moves_pinned[2];               // by color, pins when its legal moves were recorded
+    int moves_king_sq[2];               // by color, king cell when its legal moves were recorded
+    uint64_t material;                  // piece counts, see material.h
     enum PieceColor turn;
     unsigned int move_count;
     unsigned int fullmoves;
     unsigned int halfmove_clock;
+    uint64_t key_history[KEY_HISTORY_SIZE];   // by halfmove clock, position keys since the last capture or pawn move
 } Board;
 
 typedef struct {
@@ -93,12 +141,4 @@ typedef struct {
     char *text;
 } PromotionWindow;
 
-
-enum SoundType {
-    move_sound,
-    capture_sound,
-};
-
-extern Sound sounds[2];
-
 #endif // DECLARATIONS_H
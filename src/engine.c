@@ -0,0 +1,243 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "engine.h"
+#include "tools.h"
+#include "zobrist.h"
+
+// Searches recurse with their move lists on the stack
+#define ENGINE_STACK_SIZE (1024 * 1024)
+
+enum EngineRequest {
+    no_request,
+    think_request,
+    ponder_request,
+    analysis_request,
+    hint_request,
+};
+
+static pthread_t thread;
+static bool running = false;
+static bool stopping = false;
+static atomic_bool stop_search;
+
+// Latest request and results, guarded by lock. Each request bumps
+// generation, so results of an older search are dropped
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t request_ready = PTHREAD_COND_INITIALIZER;
+static enum EngineRequest request = no_request;
+static Position request_root;
+static int request_millis;
+static int request_threads;
+static int request_lines;
+static unsigned int generation = 0;
+static SearchMove posted_move;
+static uint64_t posted_key;
+static bool move_ready = false;
+static SearchReport report;
+static bool have_report = false;
+static bool pondering = false;
+
+// Hints search until a deadline, then wait inside the search for more time,
+// so asking again about the same position deepens it instead of starting
+// over. hinting is whether the search of this generation is a hint
+static bool hinting = false;
+static uint64_t hint_key;
+static double hint_deadline;
+
+static void postProgress(const SearchReport *r, void *arg)
+{
+    unsigned int started = (unsigned int)(uintptr_t)arg;
+    pthread_mutex_lock(&lock);
+    if (started == generation) {
+        report = *r;
+        have_report = true;
+    }
+    // A hint out of time waits here, its search kept, until given more
+    while (started == generation && hinting && !stopping && clockSeconds() >= hint_deadline)
+        pthread_cond_wait(&request_ready, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+static void *engineLoop(void *p)
+{
+    Position *root = p;
+
+    pthread_mutex_lock(&lock);
+    while (!stopping) {
+        if (request == no_request) {
+            pthread_cond_wait(&request_ready, &lock);
+            continue;
+        }
+        enum EngineRequest r = request;
+        unsigned int started = generation;
+        int millis = request_millis;
+        int threads = request_threads;
+        int lines = request_lines;
+        *root = request_root;
+        request = no_request;
+        pondering = r == ponder_request;
+        atomic_store(&stop_search, false);
+        pthread_mutex_unlock(&lock);
+
+        // Pondering and analysis go on until the position changes
+        SearchLimits limits = {
+            .millis = (r == think_request) ? millis : 0,
+            .threads = threads,
+            .multi_pv = lines,
+            .stop = &stop_search,
+        };
+        SearchReport result = searchPosition(root, limits, postProgress, (void *)(uintptr_t)started);
+
+        pthread_mutex_lock(&lock);
+        if (started == generation) {
+            report = result;
+            have_report = true;
+            pondering = false;
+            if (r == think_request && result.best.from != result.best.to) {
+                posted_move = result.best;
+                posted_key = root->key;
+                move_ready = true;
+            }
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    free(root);
+    return NULL;
+}
+
+void startEngine(void)
+{
+    if (running)
+        return;
+    initSearch();
+
+    Position *root = malloc(sizeof(Position));
+    assert(root != NULL && "Couldn't allocate engine position");
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, ENGINE_STACK_SIZE);
+    stopping = false;
+    running = pthread_create(&thread, &attr, engineLoop, root) == 0;
+    pthread_attr_destroy(&attr);
+    if (!running)
+        free(root);
+}
+
+void stopEngine(void)
+{
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    atomic_store(&stop_search, true);
+    pthread_cond_broadcast(&request_ready);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(thread, NULL);
+    running = false;
+}
+
+// Replaces whatever the engine is doing with a search of b
+static void requestSearch(const Board *b, enum EngineRequest r, int millis, int threads, int lines)
+{
+    pthread_mutex_lock(&lock);
+    generation++;
+    positionFromBoard(&request_root, b);
+    request = r;
+    request_millis = millis;
+    request_threads = threads;
+    request_lines = lines;
+    hinting = r == hint_request;
+    move_ready = false;
+    have_report = false;
+    atomic_store(&stop_search, true);
+    pthread_cond_broadcast(&request_ready);
+    pthread_mutex_unlock(&lock);
+}
+
+// Starts looking for a move of the side to move in b, posted once found
+// within millis milliseconds, see takeEngineMove
+void thinkAbout(const Board *b, int millis)
+{
+    requestSearch(b, think_request, millis, 1, 1);
+}
+
+// Searches b with no time limit while the player thinks, which fills the
+// transposition table with replies to each of the player's moves
+void ponderOn(const Board *b)
+{
+    requestSearch(b, ponder_request, 0, 1, 1);
+}
+
+// Searches b with no time limit on threads threads, until another request
+// or haltEngine, scoring the best lines moves. Progress is read with
+// engineReport
+void analyze(const Board *b, int threads, int lines)
+{
+    requestSearch(b, analysis_request, 0, threads, lines);
+}
+
+// Searches b for a move to suggest to the player, for millis milliseconds.
+// Asked again about the same position, the search goes on for millis more
+// from where it paused. The move is read with engineReport
+void hint(const Board *b, int millis)
+{
+    uint64_t key = positionKey(b);
+    pthread_mutex_lock(&lock);
+    bool deepen = hinting && hint_key == key;
+    double from = (deepen && hint_deadline > clockSeconds()) ? hint_deadline : clockSeconds();
+    hint_key = key;
+    hint_deadline = from + millis / 1000.0;
+    pthread_cond_broadcast(&request_ready);
+    pthread_mutex_unlock(&lock);
+
+    if (!deepen)
+        requestSearch(b, hint_request, 0, 1, 1);
+}
+
+// Drops the current search and any move posted by it
+void haltEngine(void)
+{
+    pthread_mutex_lock(&lock);
+    generation++;
+    request = no_request;
+    move_ready = false;
+    have_report = false;
+    pondering = false;
+    hinting = false;
+    atomic_store(&stop_search, true);
+    pthread_cond_broadcast(&request_ready);
+    pthread_mutex_unlock(&lock);
+}
+
+// Takes the posted move into m, if there is one for the position of b
+bool takeEngineMove(const Board *b, SearchMove *m)
+{
+    pthread_mutex_lock(&lock);
+    bool taken = move_ready && posted_key == positionKey(b);
+    if (taken) {
+        *m = posted_move;
+        move_ready = false;
+    }
+    pthread_mutex_unlock(&lock);
+    return taken;
+}
+
+// Copies progress of the current or last search into r
+bool engineReport(SearchReport *r, bool *is_pondering)
+{
+    pthread_mutex_lock(&lock);
+    bool have = have_report;
+    if (have) {
+        *r = report;
+        *is_pondering = pondering;
+    }
+    pthread_mutex_unlock(&lock);
+    return have;
+}
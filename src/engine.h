@@ -0,0 +1,22 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "declarations.h"
+#include "search.h"
+
+// Computer player searching on a background thread. The GUI asks it for a
+// move, keeps drawing, and takes the move once it is posted. Analysis
+// searches the position on screen on several threads until told otherwise,
+// hints search the player's position a little longer each time asked
+
+void startEngine(void);
+void stopEngine(void);
+void thinkAbout(const Board *b, int millis);
+void ponderOn(const Board *b);
+void analyze(const Board *b, int threads, int lines);
+void hint(const Board *b, int millis);
+void haltEngine(void);
+bool takeEngineMove(const Board *b, SearchMove *m);
+bool engineReport(SearchReport *r, bool *pondering);
+
+#endif // ENGINE_H
@@ -3,99 +3,75 @@
 
 #include "fillers.h"
 #include "tools.h"
+#include "masks.h"
+#include "squares.h"
 
-void fillMovableCells(const Cell touched, Board *b)
+// Marks the castling cells and a pending move of the touched piece, from
+// moves recorded by recordLegalMoves. Views mark its cells themselves, see
+// colorMovableCells
+void fillLegalCells(Board *restrict b, int sq)
 {
-    // Reset movable cells
-    for (int i = 0; i < 8; i++)
-        for (int j = 0; j < 8; j++)
-            b->cells[i][j].is_movable = false;
-
-    fillCellsInRange(touched, b);
-    filterCellsInRange(touched, b);
+    const Cell *touched = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    enum PieceColor tcolor = touched->piece.color;
+    Mask legal = b->legal_moves[sq];
+
+    b->castling_cells[tcolor][queenside] = NULL;
+    b->castling_cells[tcolor][kingside] = NULL;
+    Mask targets = (touched->piece.type == king) ? legal : 0;
+    while (targets) {
+        int to = popLsb(&targets);
+        int side = castlingSide(b, tcolor, sq, to);
+        if (side != -1)
+            b->castling_cells[tcolor][side] = &(b->cells[SQ_Y(to)][SQ_X(to)]);
+    }
+    b->move_pending = legal != 0;
 }
 
-void fillCellsInRange(const Cell touched, Board *b)
+void fillCellsInRange(Board *restrict b, int sq)
 {
+    const Cell *touched = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+
     // Reset cells in range
-    for (int y = 0; y < 8; y++)
-        for (int x = 0; x < 8; x++)
-            b->cells[y][x].in_range = false;    
+    b->in_range = 0;
 
-    enum PieceType ttype = touched.piece.type;
-    enum PieceColor tcolor = touched.piece.color;
+    enum PieceType ttype = touched->piece.type;
+    enum PieceColor tcolor = touched->piece.color;
 
     switch (ttype) {
     case pawn:
-        fillCellsInRangePawn(touched, b);
+        fillCellsInRangePawn(b, sq);
         break;
     case rook:
     case bishop:
-        fillCellsInRangeContinuous(touched, ttype, b);
+        fillCellsInRangeContinuous(b, sq, ttype);
         break;
     case queen:
-        fillCellsInRangeContinuous(touched, rook, b);
-        fillCellsInRangeContinuous(touched, bishop, b);
+        fillCellsInRangeContinuous(b, sq, rook);
+        fillCellsInRangeContinuous(b, sq, bishop);
         break;
     case knight:
-        fillCellsInRangeKnight(touched, b);
+        fillCellsInRangeKnight(b, sq);
         break;
     case king:
-        fillCellsInRangeKing(touched, b);
+        fillCellsInRangeKing(b, sq);
         break;
     default:
         fprintf(stderr, "Not implemented!\n");
     }
 
     if (ttype == king) {
-        b->queenside_castling_cell[tcolor] = NULL;
-        b->kingside_castling_cell[tcolor] = NULL;
-        fillCastlingCells(touched, b);
-    }
-}
-
-void filterCellsInRange(const Cell touched, Board *b)
-{
-    enum PieceType ttype = touched.piece.type;
-    enum PieceColor tcolor = touched.piece.color;
-
-    for (int i = 0; i < 8; i++) {
-        for (int j = 0; j < 8; j++) {
-
-            Cell *cell = &(b->cells[i][j]);
-            if (!cell->in_range)
-                continue;
-
-            // Filter pieces of same color
-            if (cell->piece.color == tcolor) {
-                continue;
-            }
-
-            // Filter cells dangerous if king is moving
-            if (ttype == king && cell->is_dangerous[tcolor]) {
-                continue;
-            }
-
-            // Filter cells that don't block check when some piece moves there
-            if (b->king_checked && b->filter_nonblocking_cells && !touched.check_blocking_cells[i][j]) {
-                continue;
-            }
-
-            // Filter cells that might open a check to our king
-            if (b->filter_check_opening && touched.opens_check && touched.check_opening_cells[i][j])
-                continue;
-
-            cell->is_movable = true;
-            b->move_pending = true;
-        }
+        b->castling_cells[tcolor][queenside] = NULL;
+        b->castling_cells[tcolor][kingside] = NULL;
+        fillCastlingCells(b, sq);
     }
 }
 
-void fillCellsInRangePawn(const Cell touched, Board *b)
+void fillCellsInRangePawn(Board *restrict b, int sq)
 {
-    V2 ti = touched.idx;
-    enum PieceColor tcolor = touched.piece.color;
-    enum PieceType ttype = touched.piece.type;
+    const Cell *touched = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    V2 ti = touched->idx;
+    enum PieceColor tcolor = touched->piece.color;
+    enum PieceType ttype = touched->piece.type;
 
     if (ttype != pawn)
         assert(0 && "ttype != pawn\n");
@@ -107,36 +83,38 @@ void fillCellsInRangePawn(const Cell touched, Board *b)
 
     // Straight move (should be empty)
     int move_limit = in_starting_position ? 2 : 1;
+    Square s = toSquare(ti);
     for (int dy = 1; dy <= move_limit; dy++) {
-        int j = ti.y + dy * dir;
-        if (!validCellIdx(ti.x, j) || !emptyCell(b->cells[j][ti.x]))
+        s = stepSquare(s, 0, dir);
+        if (!onBoard(s) || !emptyCell(cellAt(b, s)))
             break;
-        b->cells[j][ti.x].in_range = true;
+        b->in_range |= squareBit(s);
     }
 
     // Diagonal moves (captures or en passant)
-    int j = ti.y + dir;
     int x_directions[2] = {-1, 1};
 
     for (int k = 0; k < 2; k++) {
-        int x = ti.x + x_directions[k];
-        if (!validCellIdx(x, j))
+        Square d = stepSquare(toSquare(ti), x_directions[k], dir);
+        if (!onBoard(d))
             continue;
 
-        bool capturable = !emptyCell(b->cells[j][x]);
+        Cell *cell = cellAt(b, d);
+        bool capturable = !emptyCell(cell);
         bool passantable =
             b->has_en_passant_target &&
-            b->en_passant_target_idx.y == j &&
-            b->en_passant_target_idx.x == x;
+            b->en_passant_target_idx.y == cell->idx.y &&
+            b->en_passant_target_idx.x == cell->idx.x;
         if (capturable || passantable)
-            b->cells[j][x].in_range = true;
+            b->in_range |= squareBit(d);
     }
 }
 
 
-void fillCellsInRangeContinuous(const Cell touched, enum PieceType ttype, Board *b)
+void fillCellsInRangeContinuous(Board *restrict b, int sq, enum PieceType ttype)
 {
-    V2 ti = touched.idx;
+    const Cell *touched = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    V2 ti = touched->idx;
 
     bool moves_continuous = (ttype == rook || ttype == bishop || ttype == queen);
     if (!moves_continuous)
@@ -163,26 +141,23 @@ void fillCellsInRangeContinuous(const Cell touched, enum PieceType ttype, Board
     for (int l = 0; l < 2; l++) {
         for (int m = 0; m < 2; m++) {
             V2 vec = vectors[l][m];
-            int i = ti.x + vec.x;
-            int j = ti.y + vec.y;
+            Square s = stepSquare(toSquare(ti), vec.x, vec.y);
 
-            while (validCellIdx(i, j)) {
-                if (!emptyCell(b->cells[j][i])) {
-                    b->cells[j][i].in_range = true;
+            while (onBoard(s)) {
+                b->in_range |= squareBit(s);
+                if (!emptyCell(cellAt(b, s)))
                     break;
-                }
-                b->cells[j][i].in_range = true;
-                i += vec.x;
-                j += vec.y;
+                s = stepSquare(s, vec.x, vec.y);
             }
         }
     }
 }
 
-void fillCellsInRangeKnight(const Cell touched, Board *b)
+void fillCellsInRangeKnight(Board *restrict b, int sq)
 {
-    V2 ti = touched.idx;
-    enum PieceType ttype = touched.piece.type;
+    const Cell *touched = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    V2 ti = touched->idx;
+    enum PieceType ttype = touched->piece.type;
 
     if (ttype != knight)
         assert(0 && "ttype != knight\n");
@@ -190,59 +165,128 @@ void fillCellsInRangeKnight(const Cell touched, Board *b)
     int dy[8] = {2, 2, -2, -2, 1, 1, -1, -1};
     int dx[8] = {-1, 1, -1, 1, -2, 2, -2, 2};
     for (int k = 0; k < 8; k++) {
-        int i = ti.x + dx[k];
-        int j = ti.y + dy[k];
-        if (!validCellIdx(i, j)) continue;
-        b->cells[j][i].in_range = true;
+        Square s = stepSquare(toSquare(ti), dx[k], dy[k]);
+        if (!onBoard(s)) continue;
+        b->in_range |= squareBit(s);
     }
 }
 
-void fillCellsInRangeKing(const Cell touched, Board *b)
+void fillCellsInRangeKing(Board *restrict b, int sq)
 {
-    V2 ti = touched.idx;
-    enum PieceType ttype = touched.piece.type;
+    const Cell *touched = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    V2 ti = touched->idx;
+    enum PieceType ttype = touched->piece.type;
 
     if (ttype != king)
         assert(0 && "ttype != king\n");
 
-    for (int j = ti.y - 1; j <= ti.y + 1; j++) {
-        for (int i = ti.x - 1; i <= ti.x + 1; i++) {
-            if ((i == ti.x && j == ti.y) || !validCellIdx(i, j))
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            Square s = stepSquare(toSquare(ti), dx, dy);
+            if ((dx == 0 && dy == 0) || !onBoard(s))
                continue;
-            b->cells[j][i].in_range = true;
+            b->in_range |= squareBit(s);
         }
     }
 }
 
-void fillCastlingCells(const Cell touched, Board *b)
+void fillCastlingCells(Board *restrict b, int sq)
 {
     // Cannot castle when king is in check
     if (b->king_checked)
         return;
 
-    V2 ti = touched.idx;
-    enum PieceColor tcolor = touched.piece.color;
-    enum PieceType ttype = touched.piece.type;
+    const Cell *touched = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    enum PieceColor tcolor = touched->piece.color;
+    enum PieceType ttype = touched->piece.type;
+    enum PieceColor them = (tcolor == black) ? white : black;
 
     if (ttype != king)
         assert(0 && "ttype != king, cannot fill castling cells\n");
 
-    bool queenside_empty = emptyCell(b->cells[ti.y][1]) &&
-                      emptyCell(b->cells[ti.y][2]) &&
-                      emptyCell(b->cells[ti.y][3]);
-    bool queenside_attacked = b->cells[ti.y][1].is_dangerous[tcolor] ||
-                          b->cells[ti.y][2].is_dangerous[tcolor] ||
-                          b->cells[ti.y][3].is_dangerous[tcolor];
-    bool kingside_empty = emptyCell(b->cells[ti.y][5]) && emptyCell(b->cells[ti.y][6]);
-    bool kingside_attacked = b->cells[ti.y][5].is_dangerous[tcolor] ||
-                           b->cells[ti.y][6].is_dangerous[tcolor];
-
-    if (b->queenside_castle_available[tcolor] && queenside_empty && !queenside_attacked) {
-        b->cells[ti.y][2].in_range = true;
-        b->queenside_castling_cell[tcolor] = &(b->cells[ti.y][2]);
+    for (int side = queenside; side <= kingside; side++) {
+        const CastlingRule *rule = castlingRule(b, tcolor, side);
+        if (!(b->castling_rights & CASTLE_RIGHT(tcolor, side)) || sq != rule->king_from)
+            continue;
+
+        // Cells between king, rook and their destinations must be empty,
+        // cells king walks on must not be attacked once both have left
+        // theirs: dangerous cells are seen with the rook still in place
+        Mask occupied = b->occupied[black] | b->occupied[white];
+        Mask others = occupied & ~BIT(rule->king_from) & ~BIT(rule->rook_from);
+        if (others & rule->path)
+            continue;
+        Mask after = others | BIT(rule->rook_to);
+        bool possible = true;
+        Mask safe = rule->safe;
+        while (safe && possible)
+            possible = !(attackersTo(b, popLsb(&safe), after) & b->occupied[them]);
+        if (!possible)
+            continue;
+
+        int target = castlingTarget(b, tcolor, side);
+        b->in_range |= BIT(target);
+        b->castling_cells[tcolor][side] = &(b->cells[SQ_Y(target)][SQ_X(target)]);
     }
-    if (b->kingside_castle_available[tcolor] && kingside_empty && !kingside_attacked) {
-        b->cells[ti.y][6].in_range = true;
-        b->kingside_castling_cell[tcolor] = &(b->cells[ti.y][6]);
+}
+
+#ifdef VERIFY_LEGAL_MOVES
+
+// Movable cells from the piece state recordPieceState simulates, which only
+// VERIFY builds record. Checks the legal moves kept by recordLegalMoves
+void fillMovableCells(Board *restrict b, int sq)
+{
+    // Reset movable cells
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 8; j++)
+            b->cells[i][j].is_movable = false;
+
+    fillCellsInRange(b, sq);
+    filterCellsInRange(b, sq);
+}
+
+void filterCellsInRange(Board *restrict b, int sq)
+{
+    const Cell *touched = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    enum PieceType ttype = touched->piece.type;
+    enum PieceColor tcolor = touched->piece.color;
+
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+
+            Cell *cell = &(b->cells[i][j]);
+            if (!(b->in_range & BIT(SQ(j, i))))
+                continue;
+
+            // A chess960 king castles by moving onto its own rook, which
+            // fillCastlingCells has already checked
+            bool castling = ttype == king &&
+                            (cell == b->castling_cells[tcolor][queenside] ||
+                             cell == b->castling_cells[tcolor][kingside]);
+
+            // Filter pieces of same color
+            if (cell->piece.color == tcolor && !castling) {
+                continue;
+            }
+
+            // Filter cells dangerous if king is moving
+            if (ttype == king && cell->is_dangerous[tcolor] && !castling) {
+                continue;
+            }
+
+            // Filter cells that don't block check when some piece moves there
+            if (b->king_checked && b->filter_nonblocking_cells && !(touched->check_blocking_cells & BIT(SQ(j, i)))) {
+                continue;
+            }
+
+            // Filter cells that might open a check to our king
+            if (b->filter_check_opening && touched->opens_check && (touched->check_opening_cells & BIT(SQ(j, i))))
+                continue;
+
+            cell->is_movable = true;
+            b->move_pending = true;
+        }
     }
 }
+
+#endif // VERIFY_LEGAL_MOVES
@@ -3,13 +3,16 @@
 
 #include "declarations.h"
 
-void fillMovableCells(const Cell touched, Board *b);
-void fillCellsInRange(const Cell touched, Board *b);
-void fillCellsInRangePawn(const Cell touched, Board *b);
-void fillCellsInRangeContinuous(const Cell touched, enum PieceType ttype, Board *b);
-void fillCellsInRangeKnight(const Cell touched, Board *b);
-void fillCellsInRangeKing(const Cell touched, Board *b);
-void fillCastlingCells(const Cell touched, Board *b);
-void filterCellsInRange(const Cell touched, Board *b);
+void fillLegalCells(Board *restrict b, int sq);
+void fillCellsInRange(Board *restrict b, int sq);
+void fillCellsInRangePawn(Board *restrict b, int sq);
+void fillCellsInRangeContinuous(Board *restrict b, int sq, enum PieceType ttype);
+void fillCellsInRangeKnight(Board *restrict b, int sq);
+void fillCellsInRangeKing(Board *restrict b, int sq);
+void fillCastlingCells(Board *restrict b, int sq);
+#ifdef VERIFY_LEGAL_MOVES
+void fillMovableCells(Board *restrict b, int sq);
+void filterCellsInRange(Board *restrict b, int sq);
+#endif
 
 #endif // FILLERS_H
\ No newline at end of file
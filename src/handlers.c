@@ -7,26 +7,40 @@
 #include "recorders.h"
 #include "tools.h"
 #include "fillers.h"
+#include "masks.h"
+#include "successors.h"
 
-void handleTouch(int mouse_x, int mouse_y, Board *b)
+// Makes a legal move of the side to move, taking the board after it from
+// the successors when they have it
+static void playMove(Board *b, BoardView *v, Move move)
+{
+    decolorKingIfChecked(b, v);
+    decolorLastMove(b, v);
+    if (!takeSuccessor(b, move, b))
+        makeMove(move, b);
+    speculateSuccessors(b);
+    playMoveSound(b);
+    colorLastMove(b, v);
+    colorKingIfChecked(b, v);
+}
+
+void handleTouch(int mouse_x, int mouse_y, Board *b, BoardView *v)
 {
     // Always color these
-    resetCellBackgrounds(b);
-    colorKingIfChecked(b);
-    colorLastMove(b);
+    resetCellBackgrounds(v);
+    colorKingIfChecked(b, v);
+    colorLastMove(b, v);
 
     V2 ti = cellIdxByPos(mouse_x, mouse_y);     // touched idx
     Cell *touched = &(b->cells[ti.y][ti.x]);
     enum PieceColor tcolor = touched->piece.color;
 
     if (b->move_pending) {
-        if (touched->is_movable) {
+        int from = cellSq(b->active_cell);
+        int to = cellSq(touched);
+        if (b->legal_moves[from] & BIT(to)) {
             Move move = {.src = b->active_cell, .dst = touched};
-            decolorKingIfChecked(b);
-            decolorLastMove(b);
-            makeMove(move, b);
-            colorLastMove(b);
-            colorKingIfChecked(b);
+            playMove(b, v, move);
             return;
         }
         else {
@@ -37,18 +51,30 @@ void handleTouch(int mouse_x, int mouse_y, Board *b)
     if (tcolor != b->turn)
         return;
 
-    if (emptyCell(*touched))
+    if (emptyCell(touched))
         return;
 
-    recolorCell(touched, COLOR_CELL_ACTIVE);
+    recolorCell(v, ti, COLOR_CELL_ACTIVE);
     b->active_cell = touched;
     b->move_pending = false;
 
-    fillMovableCells(*touched, b);
-    colorMovableCells(*touched, b);
+    fillLegalCells(b, cellSq(touched));
+    colorMovableCells(touched, b, v);
+
+#ifdef VERIFY_LEGAL_MOVES
+    // Simulating every move of the piece has to agree with recorded moves
+    static Board full;
+    full = *b;
+    recordPieceState(&full, cellSq(touched));
+    fillMovableCells(&full, cellSq(touched));
+    for (int y = 0; y < 8; y++)
+        for (int x = 0; x < 8; x++)
+            if (full.cells[y][x].is_movable != v->cells[y][x].is_movable)
+                assert(0 && "Simulated moves differ from recorded legal moves");
+#endif
 }
 
-void handlePromotion(int mouse_x, int mouse_y, Board *b, const PromotionWindow pwin)
+void handlePromotion(int mouse_x, int mouse_y, Board *b, BoardView *v, const PromotionWindow pwin)
 {
     if (!b->promotion_pending)
         assert(0 && "!b->promotion_pending\n");
@@ -63,11 +89,59 @@ void handlePromotion(int mouse_x, int mouse_y, Board *b, const PromotionWindow p
         return;
 
     int idx = (mouse_x - fx) / CELL_SIZE;
-    Piece chosen = {.type = pwin.promotables[idx], .color = b->promoting_cell->piece.color};
-    b->promoting_cell->piece = chosen;
-    b->promotion_pending = false;
-    b->promoting_cell = NULL;
+    completePromotion(b, pwin.promotables[idx]);
+    speculateSuccessors(b);
+    colorKingIfChecked(b, v);
+}
+
+// Plays a move found by the engine, promoting to the piece it chose
+void handleComputerMove(Board *b, BoardView *v, SearchMove m)
+{
+    resetCellBackgrounds(v);
+    Move move = {
+        .src = &(b->cells[SQ_Y(m.from)][SQ_X(m.from)]),
+        .dst = &(b->cells[SQ_Y(m.to)][SQ_X(m.to)]),
+    };
+    playMove(b, v, move);
+
+    if (b->promotion_pending) {
+        completePromotion(b, m.promotion);
+        speculateSuccessors(b);
+        colorKingIfChecked(b, v);
+    }
+}
 
-    recordStateChangesAfterMove(b);
-    colorKingIfChecked(b);
+void playMoveSound(const Board *b)
+{
+    if (b->last_move_captured)
+        PlaySound(sounds[capture_sound]);
+    else
+        PlaySound(sounds[move_sound]);
+}
+
+PromotionWindow initPromotionWindow(void)
+{
+    PromotionWindow pwin;
+    pwin.promotables[0] = queen;
+    pwin.promotables[1] = rook;
+    pwin.promotables[2] = knight;
+    pwin.promotables[3] = bishop;
+
+    pwin.padding = 10;
+    pwin.cell_margin = 5;
+
+    pwin.text = "Promote To";
+    pwin.text_height = 30;
+    pwin.text_width = MeasureText(pwin.text, pwin.text_height);
+
+    pwin.height = CELL_SIZE + pwin.padding * 3 + pwin.text_height;
+    pwin.width = CELL_SIZE * 4 + pwin.cell_margin * 3 + pwin.padding * 2;
+
+    pwin.pos.x = BOARD_SIZE / 2 - pwin.width / 2;
+    pwin.pos.y = BOARD_SIZE / 2 - pwin.height / 2;
+    pwin.first_cell_pos.x = pwin.pos.x + pwin.padding;
+    pwin.first_cell_pos.y = pwin.pos.y + pwin.padding * 2 + pwin.text_height;
+
+    return pwin;
 }
+
@@ -1,9 +1,23 @@
 #ifndef HANDLERS_H
 #define HANDLERS_H
 
+#include <raylib.h>
+
 #include "declarations.h"
+#include "colorizers.h"
+#include "position.h"
+
+enum SoundType {
+    move_sound,
+    capture_sound,
+};
+
+extern Sound sounds[2];
 
-void handleTouch(int mouse_x, int mouse_y, Board *b);
-void handlePromotion(int mouse_x, int mouse_y, Board *b, const PromotionWindow pwin);
+void handleTouch(int mouse_x, int mouse_y, Board *b, BoardView *v);
+void handlePromotion(int mouse_x, int mouse_y, Board *b, BoardView *v, const PromotionWindow pwin);
+void handleComputerMove(Board *b, BoardView *v, SearchMove m);
+void playMoveSound(const Board *b);
+PromotionWindow initPromotionWindow(void);
 
 #endif // HANDLERS_H
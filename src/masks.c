@@ -0,0 +1,249 @@
+#include <stdbool.h>
+
+#include "masks.h"
+
+// Directions 0-3 walk towards higher bits, 4-7 towards lower bits
+static const int ray_dx[8] = {1, 0, 1, -1, -1, 0, -1, 1};
+static const int ray_dy[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+static Mask knight_masks[64];
+static Mask king_masks[64];
+static Mask pawn_masks[2][64];
+static Mask ray_masks[8][64];
+#ifdef BOARD_0X88
+// Ray direction from one cell to another, indexed by the difference of
+// their 0x88 numbers. Stands in for the 64x64 tables below, 240 bytes
+// instead of 64KB
+static signed char delta_dirs[240];
+#else
+static Mask between_masks[64][64];
+static Mask line_masks[64][64];
+#endif
+static bool masks_ready = false;
+
+static Mask maskFromOffsets(int sq, const int *dx, const int *dy, int count)
+{
+    Mask m = 0;
+    for (int k = 0; k < count; k++) {
+        int x = SQ_X(sq) + dx[k];
+        int y = SQ_Y(sq) + dy[k];
+        if (0 <= x && x < 8 && 0 <= y && y < 8)
+            m |= BIT(SQ(x, y));
+    }
+    return m;
+}
+
+// Fills lookup tables, safe to call more than once
+void initMasks(void)
+{
+    if (masks_ready)
+        return;
+
+    int knight_dx[8] = {-1, 1, -1, 1, -2, 2, -2, 2};
+    int knight_dy[8] = {2, 2, -2, -2, 1, 1, -1, -1};
+    int king_dx[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+    int king_dy[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+    int pawn_dx[2] = {-1, 1};
+    int black_dy[2] = {1, 1};       // black goes down
+    int white_dy[2] = {-1, -1};     // white goes up
+
+    for (int sq = 0; sq < 64; sq++) {
+        knight_masks[sq] = maskFromOffsets(sq, knight_dx, knight_dy, 8);
+        king_masks[sq] = maskFromOffsets(sq, king_dx, king_dy, 8);
+        pawn_masks[black][sq] = maskFromOffsets(sq, pawn_dx, black_dy, 2);
+        pawn_masks[white][sq] = maskFromOffsets(sq, pawn_dx, white_dy, 2);
+
+        for (int dir = 0; dir < 8; dir++) {
+            Mask ray = 0;
+            int x = SQ_X(sq) + ray_dx[dir];
+            int y = SQ_Y(sq) + ray_dy[dir];
+            while (0 <= x && x < 8 && 0 <= y && y < 8) {
+                ray |= BIT(SQ(x, y));
+                x += ray_dx[dir];
+                y += ray_dy[dir];
+            }
+            ray_masks[dir][sq] = ray;
+        }
+    }
+
+#ifdef BOARD_0X88
+    for (int d = 0; d < 240; d++)
+        delta_dirs[d] = -1;
+    for (int dir = 0; dir < 8; dir++)
+        for (int k = 1; k < 8; k++)
+            delta_dirs[119 + k * (ray_dy[dir] * 16 + ray_dx[dir])] = dir;
+#else
+    for (int a = 0; a < 64; a++) {
+        for (int b = 0; b < 64; b++) {
+            between_masks[a][b] = 0;
+            line_masks[a][b] = 0;
+        }
+        for (int dir = 0; dir < 8; dir++) {
+            int opposite = (dir + 4) % 8;
+            Mask ray = ray_masks[dir][a];
+            while (ray) {
+                int b = popLsb(&ray);
+                between_masks[a][b] = ray_masks[dir][a] & ray_masks[opposite][b];
+                line_masks[a][b] = ray_masks[dir][a] | ray_masks[opposite][a] | BIT(a);
+            }
+        }
+    }
+#endif
+
+    masks_ready = true;
+}
+
+Mask knightAttacks(int sq)
+{
+    return knight_masks[sq];
+}
+
+Mask kingAttacks(int sq)
+{
+    return king_masks[sq];
+}
+
+// Cells a pawn of given color on sq threatens
+Mask pawnAttacks(enum PieceColor color, int sq)
+{
+    return pawn_masks[color][sq];
+}
+
+// Cells seen along a ray, including the first blocker
+static Mask rayAttacks(int dir, int sq, Mask occupied)
+{
+    Mask attacks = ray_masks[dir][sq];
+    Mask blockers = attacks & occupied;
+    if (blockers) {
+        int first = (dir < 4) ? lsb(blockers) : 63 - __builtin_clzll(blockers);
+        attacks ^= ray_masks[dir][first];
+    }
+    return attacks;
+}
+
+Mask rookAttacks(int sq, Mask occupied)
+{
+    return rayAttacks(0, sq, occupied) | rayAttacks(1, sq, occupied) |
+           rayAttacks(4, sq, occupied) | rayAttacks(5, sq, occupied);
+}
+
+Mask bishopAttacks(int sq, Mask occupied)
+{
+    return rayAttacks(2, sq, occupied) | rayAttacks(3, sq, occupied) |
+           rayAttacks(6, sq, occupied) | rayAttacks(7, sq, occupied);
+}
+
+Mask pieceAttacks(Piece p, int sq, Mask occupied)
+{
+    switch (p.type) {
+    case king:
+        return king_masks[sq];
+    case queen:
+        return rookAttacks(sq, occupied) | bishopAttacks(sq, occupied);
+    case bishop:
+        return bishopAttacks(sq, occupied);
+    case knight:
+        return knight_masks[sq];
+    case rook:
+        return rookAttacks(sq, occupied);
+    case pawn:
+        return pawn_masks[p.color][sq];
+    default:
+        return 0;
+    }
+}
+
+#ifdef BOARD_0X88
+
+static int rayDirection(int a, int b)
+{
+    return delta_dirs[119 + (SQ_Y(b) - SQ_Y(a)) * 16 + SQ_X(b) - SQ_X(a)];
+}
+
+// Cells strictly between a and b, empty if they don't share a line
+Mask lineBetween(int a, int b)
+{
+    int dir = rayDirection(a, b);
+    if (dir < 0)
+        return 0;
+    return ray_masks[dir][a] & ray_masks[(dir + 4) % 8][b];
+}
+
+// Whole rank, file or diagonal through a and b, empty if they don't share one
+Mask lineThrough(int a, int b)
+{
+    int dir = rayDirection(a, b);
+    if (dir < 0)
+        return 0;
+    return ray_masks[dir][a] | ray_masks[(dir + 4) % 8][a] | BIT(a);
+}
+
+#else
+
+// Cells strictly between a and b, empty if they don't share a line
+Mask lineBetween(int a, int b)
+{
+    return between_masks[a][b];
+}
+
+// Whole rank, file or diagonal through a and b, empty if they don't share one
+Mask lineThrough(int a, int b)
+{
+    return line_masks[a][b];
+}
+
+#endif // BOARD_0X88
+
+// Pieces of any color that are the only thing standing between target and
+// one of the given sliders
+Mask sliderBlockers(int target, Mask orthogonal, Mask diagonal, Mask occupied)
+{
+    Mask blockers = 0;
+    Mask snipers = (rookAttacks(target, 0) & orthogonal) |
+                   (bishopAttacks(target, 0) & diagonal);
+    while (snipers) {
+        int sq = popLsb(&snipers);
+        Mask between = lineBetween(target, sq) & occupied;
+        if (between && !(between & (between - 1)))
+            blockers |= between;
+    }
+    return blockers;
+}
+
+// Pieces of both colors attacking sq, given the occupancy to look through
+Mask attackersTo(const Board *b, int sq, Mask occupied)
+{
+    Mask orthogonal = b->pieces[black][rook] | b->pieces[black][queen] |
+                      b->pieces[white][rook] | b->pieces[white][queen];
+    Mask diagonal = b->pieces[black][bishop] | b->pieces[black][queen] |
+                    b->pieces[white][bishop] | b->pieces[white][queen];
+
+    return (pawn_masks[white][sq] & b->pieces[black][pawn]) |
+           (pawn_masks[black][sq] & b->pieces[white][pawn]) |
+           (knight_masks[sq] & (b->pieces[black][knight] | b->pieces[white][knight])) |
+           (king_masks[sq] & (b->pieces[black][king] | b->pieces[white][king])) |
+           (rookAttacks(sq, occupied) & orthogonal) |
+           (bishopAttacks(sq, occupied) & diagonal);
+}
+
+int cellSq(const Cell *c)
+{
+    return SQ(c->idx.x, c->idx.y);
+}
+
+int lsb(Mask m)
+{
+    return __builtin_ctzll(m);
+}
+
+int popLsb(Mask *m)
+{
+    int sq = __builtin_ctzll(*m);
+    *m &= *m - 1;
+    return sq;
+}
+
+int popCount(Mask m)
+{
+    return __builtin_popcountll(m);
+}
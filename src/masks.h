@@ -0,0 +1,28 @@
+#ifndef MASKS_H
+#define MASKS_H
+
+#include "declarations.h"
+
+// Bit index of a cell is y * 8 + x, so bit 0 is the top left cell (a8)
+#define SQ(x, y)    ((y) * 8 + (x))
+#define SQ_X(sq)    ((sq) & 7)
+#define SQ_Y(sq)    ((sq) >> 3)
+#define BIT(sq)     ((Mask)1 << (sq))
+
+void initMasks(void);
+Mask knightAttacks(int sq);
+Mask kingAttacks(int sq);
+Mask pawnAttacks(enum PieceColor color, int sq);
+Mask rookAttacks(int sq, Mask occupied);
+Mask bishopAttacks(int sq, Mask occupied);
+Mask pieceAttacks(Piece p, int sq, Mask occupied);
+Mask lineBetween(int a, int b);
+Mask lineThrough(int a, int b);
+Mask sliderBlockers(int target, Mask orthogonal, Mask diagonal, Mask occupied);
+Mask attackersTo(const Board *b, int sq, Mask occupied);
+int cellSq(const Cell *c);
+int lsb(Mask m);
+int popLsb(Mask *m);
+int popCount(Mask m);
+
+#endif // MASKS_H
@@ -0,0 +1,110 @@
+#include "material.h"
+#include "masks.h"
+
+// Kinds counted in the signature, 4 bits each, after them the same for white
+enum MaterialKind {
+    queens,
+    light_bishops,
+    dark_bishops,
+    knights,
+    rooks,
+    pawns,
+    MATERIAL_KINDS,
+};
+
+#define KIND_SHIFT(color, kind) (((color) * MATERIAL_KINDS + (kind)) * 4)
+#define KIND_COUNT(m, color, kind) ((int)(((m) >> KIND_SHIFT(color, kind)) & 15))
+
+// Queens, rooks or pawns on either side can always mate
+static const uint64_t mating_material =
+    (15ULL << KIND_SHIFT(black, queens)) | (15ULL << KIND_SHIFT(black, rooks)) |
+    (15ULL << KIND_SHIFT(black, pawns)) | (15ULL << KIND_SHIFT(white, queens)) |
+    (15ULL << KIND_SHIFT(white, rooks)) | (15ULL << KIND_SHIFT(white, pawns));
+
+// Minor pieces alone are indexed by their counts, capped at 2, three counts
+// per color
+#define MINOR_INDEXES (3 * 3 * 3 * 3 * 3 * 3)
+
+static bool insufficient[MINOR_INDEXES];
+static bool material_ready = false;
+
+static int minorIndex(uint64_t m)
+{
+    int idx = 0;
+    for (int c = 0; c < 2; c++) {
+        for (int kind = light_bishops; kind <= knights; kind++) {
+            int n = KIND_COUNT(m, c, kind);
+            idx = idx * 3 + (n > 2 ? 2 : n);
+        }
+    }
+    return idx;
+}
+
+// Fills the table of minor piece counts that can't mate, safe to call more
+// than once. Those are a lone minor piece, or bishops all on one cell color
+void initMaterial(void)
+{
+    if (material_ready)
+        return;
+
+    for (int idx = 0; idx < MINOR_INDEXES; idx++) {
+        int light = 0, dark = 0, knight_count = 0;
+        int rest = idx;
+        for (int c = 0; c < 2; c++) {
+            knight_count += rest % 3;
+            rest /= 3;
+            dark += rest % 3;
+            rest /= 3;
+            light += rest % 3;
+            rest /= 3;
+        }
+        bool lone_minor = light + dark + knight_count <= 1;
+        bool same_colored_bishops = knight_count == 0 && (light == 0 || dark == 0);
+        insufficient[idx] = lone_minor || same_colored_bishops;
+    }
+    material_ready = true;
+}
+
+// Signature of piece p alone on cell sq, added when a piece appears on the
+// board and subtracted when it leaves
+uint64_t materialOf(Piece p, int sq)
+{
+    enum MaterialKind kind;
+    switch (p.type) {
+    case queen:
+        kind = queens;
+        break;
+    case bishop:
+        kind = ((SQ_X(sq) + SQ_Y(sq)) % 2 == 0) ? light_bishops : dark_bishops;
+        break;
+    case knight:
+        kind = knights;
+        break;
+    case rook:
+        kind = rooks;
+        break;
+    case pawn:
+        kind = pawns;
+        break;
+    default:
+        return 0;
+    }
+    return 1ULL << KIND_SHIFT(p.color, kind);
+}
+
+// Signature of the whole board, makeMove keeps it up to date from there on
+uint64_t materialSignature(const Board *b)
+{
+    uint64_t m = 0;
+    for (int sq = 0; sq < 64; sq++)
+        m += materialOf(b->cells[SQ_Y(sq)][SQ_X(sq)].piece, sq);
+    return m;
+}
+
+// Whether neither side can mate with the material of the signature
+bool insufficientMaterial(uint64_t material)
+{
+    if (material & mating_material)
+        return false;
+    return insufficient[minorIndex(material)];
+}
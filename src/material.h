@@ -0,0 +1,15 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "declarations.h"
+
+// Material signature: a 4 bit count per color and kind of piece, bishops
+// counted apart by the color of their cell. Kings are left out, every
+// position has one of each
+
+void initMaterial(void);
+uint64_t materialOf(Piece p, int sq);
+uint64_t materialSignature(const Board *b);
+bool insufficientMaterial(uint64_t material);
+
+#endif // MATERIAL_H
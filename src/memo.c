@@ -0,0 +1,148 @@
+#include <pthread.h>
+
+#include "memo.h"
+#include "tools.h"
+#include "zobrist.h"
+
+#define MEMO_BUCKETS (MEMO_ENTRIES * 2)     // power of two
+#define NONE (-1)
+
+typedef struct {
+    uint64_t key;
+    MemoState state;
+    int bucket_next;    // next entry of the same bucket
+    int newer;          // neighbours in use order
+    int older;
+} MemoEntry;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static MemoEntry entries[MEMO_ENTRIES];
+static int buckets[MEMO_BUCKETS];
+static int newest = NONE;
+static int oldest = NONE;
+static int used = 0;
+static bool memo_ready = false;
+static long hits = 0;
+static long lookups = 0;
+
+// Chess960 castles by rules of the start position, which the key must
+// tell apart as well
+uint64_t memoKey(const Board *b)
+{
+    uint64_t key = positionKey(b);
+    if (!b->chess960)
+        return key;
+
+    for (int c = 0; c < 2; c++) {
+        for (int side = 0; side < 2; side++) {
+            const CastlingRule *r = castlingRule(b, c, side);
+            key = (key ^ (uint64_t)(r->king_from * 64 + r->rook_from)) * 0x9e3779b97f4a7c15ULL;
+        }
+    }
+    return key;
+}
+
+static void initMemo(void)
+{
+    for (int i = 0; i < MEMO_BUCKETS; i++)
+        buckets[i] = NONE;
+    memo_ready = true;
+}
+
+static int *bucketOf(uint64_t key)
+{
+    return &buckets[(key ^ (key >> 32)) & (MEMO_BUCKETS - 1)];
+}
+
+static void unlinkUse(int i)
+{
+    MemoEntry *e = &entries[i];
+    if (e->newer != NONE)
+        entries[e->newer].older = e->older;
+    else
+        newest = e->older;
+    if (e->older != NONE)
+        entries[e->older].newer = e->newer;
+    else
+        oldest = e->newer;
+}
+
+static void linkNewest(int i)
+{
+    entries[i].newer = NONE;
+    entries[i].older = newest;
+    if (newest != NONE)
+        entries[newest].newer = i;
+    newest = i;
+    if (oldest == NONE)
+        oldest = i;
+}
+
+static int findEntry(uint64_t key)
+{
+    for (int i = *bucketOf(key); i != NONE; i = entries[i].bucket_next)
+        if (entries[i].key == key)
+            return i;
+    return NONE;
+}
+
+// Copies the state kept for key into out, marking it as just used
+bool findMemo(uint64_t key, MemoState *out)
+{
+    pthread_mutex_lock(&lock);
+    if (!memo_ready)
+        initMemo();
+
+    lookups++;
+    int i = findEntry(key);
+    if (i != NONE) {
+        hits++;
+        *out = entries[i].state;
+        unlinkUse(i);
+        linkNewest(i);
+    }
+    pthread_mutex_unlock(&lock);
+    return i != NONE;
+}
+
+// Keeps s for key, taking the place of the least recently used entry once
+// all are in use
+void storeMemo(uint64_t key, const MemoState *s)
+{
+    pthread_mutex_lock(&lock);
+    if (!memo_ready)
+        initMemo();
+
+    int i = findEntry(key);
+    if (i != NONE) {
+        unlinkUse(i);
+    }
+    else {
+        if (used < MEMO_ENTRIES) {
+            i = used++;
+        }
+        else {
+            i = oldest;
+            unlinkUse(i);
+            int *link = bucketOf(entries[i].key);
+            while (*link != i)
+                link = &entries[*link].bucket_next;
+            *link = entries[i].bucket_next;
+        }
+        int *bucket = bucketOf(key);
+        entries[i].key = key;
+        entries[i].bucket_next = *bucket;
+        *bucket = i;
+    }
+    entries[i].state = *s;
+    linkNewest(i);
+    pthread_mutex_unlock(&lock);
+}
+
+void memoStats(long *hit_count, long *lookup_count)
+{
+    pthread_mutex_lock(&lock);
+    *hit_count = hits;
+    *lookup_count = lookups;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,26 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "declarations.h"
+
+// Derived state of recently seen positions, least recently used ones are
+// dropped first. Shared by the game and successor threads
+
+#define MEMO_ENTRIES 4096
+
+// Pieces a side can have in a game. Positions set up with more, from a
+// FEN, aren't memoized
+#define MEMO_PIECES 16
+
+// Legal moves are kept by piece of the side to move, in cell order
+typedef struct {
+    Mask dangerous[2];      // cells dangerous for black and white king
+    Mask moves[MEMO_PIECES];
+} MemoState;
+
+uint64_t memoKey(const Board *b);
+bool findMemo(uint64_t key, MemoState *out);
+void storeMemo(uint64_t key, const MemoState *s);
+void memoStats(long *hits, long *lookups);
+
+#endif // MEMO_H
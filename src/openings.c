@@ -0,0 +1,49 @@
+#include <stddef.h>
+
+#include "openings.h"
+#include "zobrist.h"
+
+// The baking tool is built with NO_OPENING_TABLE, as it makes the table
+#ifndef NO_OPENING_TABLE
+
+// Generated into opening_table.c, see the Makefile
+extern const int opening_plies;
+extern const int opening_buckets;
+extern const int opening_slots;
+extern const uint32_t opening_seeds[];
+extern const OpeningEntry opening_entries[];
+extern const OpeningMove opening_moves[];
+
+// Baked entry of the position, NULL if it isn't one of the baked ones.
+// Chess960 castles differently, so only standard games use the table
+const OpeningEntry *findOpening(const Board *b)
+{
+    if (b->chess960 || b->move_count > (unsigned int)opening_plies)
+        return NULL;
+
+    uint64_t key = positionKey(b);
+    uint32_t seed = opening_seeds[openingBucket(key, opening_buckets)];
+    const OpeningEntry *e = &opening_entries[openingSlot(key, seed, opening_slots)];
+    return (e->key == key) ? e : NULL;
+}
+
+const OpeningMove *openingMoves(const OpeningEntry *e)
+{
+    return &opening_moves[e->moves];
+}
+
+#else
+
+const OpeningEntry *findOpening(const Board *b)
+{
+    (void)b;
+    return NULL;
+}
+
+const OpeningMove *openingMoves(const OpeningEntry *e)
+{
+    (void)e;
+    return NULL;
+}
+
+#endif // NO_OPENING_TABLE
@@ -0,0 +1,39 @@
+#ifndef OPENINGS_H
+#define OPENINGS_H
+
+#include "declarations.h"
+
+typedef struct {
+    uint8_t from;
+    uint8_t to;
+} OpeningMove;
+
+// Derived state of a position in the first plies of a standard game, baked
+// into the binary by tools/bake_openings.c. Legal moves of the side to move
+// are move_count moves from opening_moves[moves] on
+typedef struct {
+    uint64_t key;           // positionKey, 0 for unused slots
+    Mask dangerous[2];      // cells dangerous for black and white king
+    uint32_t moves;
+    uint16_t move_count;
+} OpeningEntry;
+
+// Perfect hash of the baked keys: keys are spread over buckets, and the
+// seed of each bucket sends all of its keys to distinct slots
+static inline int openingBucket(uint64_t key, int buckets)
+{
+    return (int)((key >> 32) % (uint64_t)buckets);
+}
+
+static inline int openingSlot(uint64_t key, uint32_t seed, int slots)
+{
+    uint64_t h = key ^ (seed * 0x9e3779b97f4a7c15ULL);
+    h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (int)(h % (uint64_t)slots);
+}
+
+const OpeningEntry *findOpening(const Board *b);
+const OpeningMove *openingMoves(const OpeningEntry *e);
+
+#endif // OPENINGS_H
@@ -0,0 +1,372 @@
+#include <assert.h>
+#include <string.h>
+
+#include "position.h"
+#include "masks.h"
+#include "material.h"
+#include "tools.h"
+#include "zobrist.h"
+
+static Mask attackersOf(const Position *p, int sq, enum PieceColor by, Mask occupied)
+{
+    enum PieceColor them = (by == white) ? black : white;
+    Mask orthogonal = p->pieces[by][rook] | p->pieces[by][queen];
+    Mask diagonal = p->pieces[by][bishop] | p->pieces[by][queen];
+    return (pawnAttacks(them, sq) & p->pieces[by][pawn]) |
+           (knightAttacks(sq) & p->pieces[by][knight]) |
+           (kingAttacks(sq) & p->pieces[by][king]) |
+           (rookAttacks(sq, occupied) & orthogonal) |
+           (bishopAttacks(sq, occupied) & diagonal);
+}
+
+// The en passant target only counts for the key when a pawn can take it,
+// as in positionKey
+static uint64_t enPassantKey(const Position *p)
+{
+    if (p->en_passant < 0)
+        return 0;
+    enum PieceColor them = (p->turn == white) ? black : white;
+    if (pawnAttacks(them, p->en_passant) & p->pieces[p->turn][pawn])
+        return en_passant_keys[SQ_X(p->en_passant)];
+    return 0;
+}
+
+static void putPiece(Position *p, uint8_t code, int sq)
+{
+    enum PieceColor c = CODE_COLOR(code);
+    enum PieceType t = CODE_TYPE(code);
+    p->squares[sq] = code;
+    p->pieces[c][t] |= BIT(sq);
+    p->occupied[c] |= BIT(sq);
+    p->key ^= piece_keys[c][t][sq];
+    p->material += materialOf((Piece){.type = t, .color = c}, sq);
+}
+
+static void liftPiece(Position *p, int sq)
+{
+    uint8_t code = p->squares[sq];
+    enum PieceColor c = CODE_COLOR(code);
+    enum PieceType t = CODE_TYPE(code);
+    p->squares[sq] = NO_PIECE;
+    p->pieces[c][t] &= ~BIT(sq);
+    p->occupied[c] &= ~BIT(sq);
+    p->key ^= piece_keys[c][t][sq];
+    p->material -= materialOf((Piece){.type = t, .color = c}, sq);
+}
+
+void positionFromBoard(Position *p, const Board *b)
+{
+    for (int c = 0; c < 2; c++) {
+        p->occupied[c] = b->occupied[c];
+        for (int t = 0; t < 6; t++)
+            p->pieces[c][t] = b->pieces[c][t];
+        p->king_sq[c] = p->pieces[c][king] ? lsb(p->pieces[c][king]) : -1;
+        for (int side = 0; side < 2; side++)
+            p->castling_rules[c][side] = *castlingRule(b, c, side);
+    }
+    for (int sq = 0; sq < 64; sq++) {
+        Piece pc = b->cells[SQ_Y(sq)][SQ_X(sq)].piece;
+        p->squares[sq] = (pc.type == no_type) ? NO_PIECE : PIECE_CODE(pc.color, pc.type);
+        p->castling_rights_kept[sq] = b->castling_rights_kept[sq];
+    }
+
+    V2 ep = b->en_passant_target_idx;
+    p->turn = b->turn;
+    p->en_passant = b->has_en_passant_target ? SQ(ep.x, ep.y) : -1;
+    p->castling_rights = b->castling_rights;
+    p->chess960 = b->chess960;
+    p->halfmove_clock = b->halfmove_clock;
+    p->material = b->material;
+    p->key = positionKey(b);
+
+    // Keys since the last capture or pawn move, the only ones that can repeat
+    p->key_count = 0;
+    if (b->halfmove_clock < KEY_HISTORY_SIZE)
+        for (unsigned int i = 0; i < b->halfmove_clock; i++)
+            p->keys[p->key_count++] = b->key_history[i];
+}
+
+static int addPawnMoves(SearchMove *moves, int n, int from, int to, enum SearchMoveKind kind)
+{
+    if (SQ_Y(to) != 0 && SQ_Y(to) != 7) {
+        moves[n++] = (SearchMove){from, to, no_type, kind};
+        return n;
+    }
+    enum PieceType promotions[] = {queen, knight, rook, bishop};
+    for (int i = 0; i < 4; i++)
+        moves[n++] = (SearchMove){from, to, promotions[i], kind};
+    return n;
+}
+
+static int addPieceMoves(const Position *p, SearchMove *moves, int n, Mask targets_allowed)
+{
+    enum PieceColor us = p->turn;
+    enum PieceColor them = (us == white) ? black : white;
+    Mask occupied = p->occupied[black] | p->occupied[white];
+
+    for (int t = king; t <= rook; t++) {
+        Mask pieces = p->pieces[us][t];
+        while (pieces) {
+            int from = popLsb(&pieces);
+            Mask targets = pieceAttacks((Piece){.type = t, .color = us}, from, occupied) &
+                           ~p->occupied[us] & targets_allowed;
+            while (targets) {
+                int to = popLsb(&targets);
+                enum SearchMoveKind kind = (p->occupied[them] & BIT(to)) ? capture_move : quiet_move;
+                moves[n++] = (SearchMove){from, to, no_type, kind};
+            }
+        }
+    }
+    return n;
+}
+
+// Castling needs the right, the rook on its cell, a free path and cells
+// the king crosses not attacked once king and rook have left
+static int addCastlingMoves(const Position *p, SearchMove *moves, int n)
+{
+    enum PieceColor us = p->turn;
+    enum PieceColor them = (us == white) ? black : white;
+    Mask occupied = p->occupied[black] | p->occupied[white];
+    if (p->king_sq[us] < 0 || attackersOf(p, p->king_sq[us], them, occupied))
+        return n;
+
+    for (int side = queenside; side <= kingside; side++) {
+        const CastlingRule *rule = &p->castling_rules[us][side];
+        if (!(p->castling_rights & CASTLE_RIGHT(us, side)) ||
+            !(p->pieces[us][rook] & BIT(rule->rook_from)))
+            continue;
+        Mask others = occupied & ~BIT(rule->king_from) & ~BIT(rule->rook_from);
+        if (others & rule->path)
+            continue;
+        Mask after = others | BIT(rule->rook_to);
+        Mask safe = rule->safe;
+        bool attacked = false;
+        while (safe && !attacked)
+            attacked = attackersOf(p, popLsb(&safe), them, after) != 0;
+        if (attacked)
+            continue;
+
+        int to = p->chess960 ? rule->rook_from : rule->king_to;
+        enum SearchMoveKind kind = (side == queenside) ? queenside_castle : kingside_castle;
+        moves[n++] = (SearchMove){rule->king_from, to, no_type, kind};
+    }
+    return n;
+}
+
+static int addPawnPushes(const Position *p, SearchMove *moves, int n, bool promotions_only)
+{
+    enum PieceColor us = p->turn;
+    Mask occupied = p->occupied[black] | p->occupied[white];
+    int direction = (us == black) ? 8 : -8;
+    int starting_y = (us == black) ? 1 : 6;
+    int last_y = (us == black) ? 7 : 0;
+
+    Mask pawns = p->pieces[us][pawn];
+    while (pawns) {
+        int from = popLsb(&pawns);
+        int to = from + direction;
+        if (occupied & BIT(to))
+            continue;
+        if (promotions_only && SQ_Y(to) != last_y)
+            continue;
+        n = addPawnMoves(moves, n, from, to, quiet_move);
+        if (!promotions_only && SQ_Y(from) == starting_y && !(occupied & BIT(to + direction)))
+            moves[n++] = (SearchMove){from, to + direction, no_type, double_push};
+    }
+    return n;
+}
+
+static int addPawnCaptures(const Position *p, SearchMove *moves, int n)
+{
+    enum PieceColor us = p->turn;
+    enum PieceColor them = (us == white) ? black : white;
+    Mask pawns = p->pieces[us][pawn];
+    while (pawns) {
+        int from = popLsb(&pawns);
+        Mask targets = pawnAttacks(us, from) & p->occupied[them];
+        while (targets)
+            n = addPawnMoves(moves, n, from, popLsb(&targets), capture_move);
+        if (p->en_passant >= 0 && (pawnAttacks(us, from) & BIT(p->en_passant)))
+            moves[n++] = (SearchMove){from, p->en_passant, no_type, en_passant_capture};
+    }
+    return n;
+}
+
+// Moves of the side to move that may still leave its king in check,
+// makePositionMove refuses those
+int generateMoves(const Position *p, SearchMove *moves)
+{
+    int n = addPawnCaptures(p, moves, 0);
+    n = addPawnPushes(p, moves, n, false);
+    n = addPieceMoves(p, moves, n, ~(Mask)0);
+    return addCastlingMoves(p, moves, n);
+}
+
+// Captures and promotions only, for quiescence search
+int generateCaptures(const Position *p, SearchMove *moves)
+{
+    enum PieceColor them = (p->turn == white) ? black : white;
+    int n = addPawnCaptures(p, moves, 0);
+    n = addPawnPushes(p, moves, n, true);
+    return addPieceMoves(p, moves, n, p->occupied[them]);
+}
+
+int generateLegalMoves(Position *p, SearchMove *moves)
+{
+    SearchMove all[256];
+    int count = generateMoves(p, all);
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        PositionUndo u;
+        if (makePositionMove(p, all[i], &u)) {
+            unmakePositionMove(p, all[i], &u);
+            moves[n++] = all[i];
+        }
+    }
+    return n;
+}
+
+bool inCheck(const Position *p)
+{
+    enum PieceColor us = p->turn;
+    enum PieceColor them = (us == white) ? black : white;
+    if (p->king_sq[us] < 0)
+        return false;
+    return attackersOf(p, p->king_sq[us], them, p->occupied[black] | p->occupied[white]) != 0;
+}
+
+// Makes m, unless it leaves the mover's king in check. Returns whether it
+// was made
+bool makePositionMove(Position *p, SearchMove m, PositionUndo *u)
+{
+    enum PieceColor us = p->turn;
+    enum PieceColor them = (us == white) ? black : white;
+    uint8_t moving = p->squares[m.from];
+
+    u->key = p->key;
+    u->material = p->material;
+    u->en_passant = p->en_passant;
+    u->halfmove_clock = p->halfmove_clock;
+    u->castling_rights = p->castling_rights;
+    u->captured = NO_PIECE;
+
+    assert(p->key_count < POSITION_HISTORY && "Position history is full");
+    p->keys[p->key_count++] = p->key;
+    p->key ^= enPassantKey(p);
+    p->en_passant = -1;
+
+    if (m.kind == queenside_castle || m.kind == kingside_castle) {
+        const CastlingRule *rule = &p->castling_rules[us][m.kind == kingside_castle];
+        uint8_t rook_code = p->squares[rule->rook_from];
+        liftPiece(p, rule->king_from);
+        liftPiece(p, rule->rook_from);
+        putPiece(p, moving, rule->king_to);
+        putPiece(p, rook_code, rule->rook_to);
+        p->king_sq[us] = rule->king_to;
+    }
+    else {
+        int taken = (m.kind == en_passant_capture) ? SQ(SQ_X(m.to), SQ_Y(m.from)) : m.to;
+        if (p->squares[taken] != NO_PIECE) {
+            u->captured = p->squares[taken];
+            liftPiece(p, taken);
+        }
+        liftPiece(p, m.from);
+        putPiece(p, (m.promotion != no_type) ? PIECE_CODE(us, m.promotion) : moving, m.to);
+        if (CODE_TYPE(moving) == king)
+            p->king_sq[us] = m.to;
+        if (m.kind == double_push)
+            p->en_passant = (m.from + m.to) / 2;
+    }
+
+    p->halfmove_clock = (u->captured != NO_PIECE || CODE_TYPE(moving) == pawn) ? 0 : p->halfmove_clock + 1;
+    p->key ^= castling_keys[p->castling_rights];
+    p->castling_rights &= p->castling_rights_kept[m.from] & p->castling_rights_kept[m.to];
+    p->key ^= castling_keys[p->castling_rights];
+    p->turn = them;
+    p->key ^= white_key;
+    p->key ^= enPassantKey(p);
+
+    Mask occupied = p->occupied[black] | p->occupied[white];
+    if (attackersOf(p, p->king_sq[us], them, occupied)) {
+        unmakePositionMove(p, m, u);
+        return false;
+    }
+    return true;
+}
+
+void unmakePositionMove(Position *p, SearchMove m, const PositionUndo *u)
+{
+    enum PieceColor them = p->turn;
+    enum PieceColor us = (them == white) ? black : white;
+
+    if (m.kind == queenside_castle || m.kind == kingside_castle) {
+        const CastlingRule *rule = &p->castling_rules[us][m.kind == kingside_castle];
+        uint8_t king_code = p->squares[rule->king_to];
+        uint8_t rook_code = p->squares[rule->rook_to];
+        liftPiece(p, rule->king_to);
+        liftPiece(p, rule->rook_to);
+        putPiece(p, king_code, rule->king_from);
+        putPiece(p, rook_code, rule->rook_from);
+        p->king_sq[us] = rule->king_from;
+    }
+    else {
+        uint8_t moved = p->squares[m.to];
+        liftPiece(p, m.to);
+        putPiece(p, (m.promotion != no_type) ? PIECE_CODE(us, pawn) : moved, m.from);
+        if (CODE_TYPE(moved) == king)
+            p->king_sq[us] = m.from;
+        if (u->captured != NO_PIECE) {
+            int taken = (m.kind == en_passant_capture) ? SQ(SQ_X(m.to), SQ_Y(m.from)) : m.to;
+            putPiece(p, u->captured, taken);
+        }
+    }
+
+    p->turn = us;
+    p->key = u->key;
+    p->material = u->material;
+    p->en_passant = u->en_passant;
+    p->halfmove_clock = u->halfmove_clock;
+    p->castling_rights = u->castling_rights;
+    p->key_count--;
+}
+
+// Whether the position occurred before, since the last capture or pawn
+// move. Once is enough for searches, the side to repeat can do so again
+bool isRepetition(const Position *p)
+{
+    int oldest = p->key_count - p->halfmove_clock;
+    if (oldest < 0)
+        oldest = 0;
+    for (int i = p->key_count - 2; i >= oldest; i -= 2)
+        if (p->keys[i] == p->key)
+            return true;
+    return false;
+}
+
+// Forgets keys from before the last capture or pawn move, which can't come
+// back, so games of any length fit the history. Only between game moves,
+// unmaking needs the keys of the moves it takes back
+void trimKeys(Position *p)
+{
+    int kept = (p->halfmove_clock < POSITION_HISTORY / 2) ? p->halfmove_clock : POSITION_HISTORY / 2;
+    if (p->key_count <= kept)
+        return;
+    memmove(p->keys, p->keys + p->key_count - kept, sizeof(uint64_t) * kept);
+    p->key_count = kept;
+}
+
+bool sameMove(SearchMove a, SearchMove b)
+{
+    return a.from == b.from && a.to == b.to && a.promotion == b.promotion;
+}
+
+// Writes m in coordinate notation, like e7e8q, into text of at least 6 chars
+void moveText(SearchMove m, char *text)
+{
+    text[0] = 'a' + SQ_X(m.from);
+    text[1] = '8' - SQ_Y(m.from);
+    text[2] = 'a' + SQ_X(m.to);
+    text[3] = '8' - SQ_Y(m.to);
+    text[4] = (m.promotion != no_type) ? "kqbnr"[m.promotion] : '\0';
+    text[5] = '\0';
+}
@@ -0,0 +1,74 @@
+#ifndef POSITION_H
+#define POSITION_H
+
+#include "declarations.h"
+
+// Position kept only as masks and piece codes, made and unmade in place for
+// searching. A Board records far more state per move than a search needs
+
+#define NO_PIECE            0xff
+#define PIECE_CODE(c, t)    ((uint8_t)((c) * 8 + (t)))
+#define CODE_COLOR(code)    ((enum PieceColor)((code) >> 3))
+#define CODE_TYPE(code)     ((enum PieceType)((code) & 7))
+
+// Keys of the game so far and of the plies searched on top of it
+#define POSITION_HISTORY    512
+
+enum SearchMoveKind {
+    quiet_move,
+    capture_move,
+    double_push,
+    en_passant_capture,
+    queenside_castle,
+    kingside_castle,
+};
+
+// Castling moves go from the king to castlingTarget, as the GUI moves it
+typedef struct {
+    uint8_t from;
+    uint8_t to;
+    uint8_t promotion;      // no_type unless a pawn reaches the last rank
+    uint8_t kind;           // enum SearchMoveKind
+} SearchMove;
+
+typedef struct {
+    Mask pieces[2][6];
+    Mask occupied[2];
+    uint8_t squares[64];                    // PIECE_CODE by cell, NO_PIECE if empty
+    enum PieceColor turn;
+    int en_passant;                         // target cell, -1 for none
+    int king_sq[2];
+    unsigned char castling_rights;
+    unsigned char castling_rights_kept[64];
+    CastlingRule castling_rules[2][2];
+    bool chess960;
+    int halfmove_clock;
+    uint64_t material;                      // see material.h
+    uint64_t key;                           // same as positionKey of the board
+    uint64_t keys[POSITION_HISTORY];        // earlier keys, newest last
+    int key_count;
+} Position;
+
+// State a move loses, for unmaking it
+typedef struct {
+    uint64_t key;
+    uint64_t material;
+    int en_passant;
+    int halfmove_clock;
+    unsigned char castling_rights;
+    uint8_t captured;
+} PositionUndo;
+
+void positionFromBoard(Position *p, const Board *b);
+int generateMoves(const Position *p, SearchMove *moves);
+int generateCaptures(const Position *p, SearchMove *moves);
+int generateLegalMoves(Position *p, SearchMove *moves);
+bool makePositionMove(Position *p, SearchMove m, PositionUndo *u);
+void unmakePositionMove(Position *p, SearchMove m, const PositionUndo *u);
+bool inCheck(const Position *p);
+bool isRepetition(const Position *p);
+void trimKeys(Position *p);
+bool sameMove(SearchMove a, SearchMove b);
+void moveText(SearchMove m, char *text);
+
+#endif // POSITION_H
@@ -0,0 +1,299 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "proof.h"
+#include "material.h"
+#include "tools.h"
+
+// Proof numbers count positions still to prove the mate (pn) or to refute
+// it (dn). Proven positions have pn 0, refuted ones dn 0
+#define INFINITE_NUMBER 100000000u
+
+// Numbers are for the attacker, the side to move at the root, so entries
+// of puzzles with white attacking are keyed apart from those with black
+#define WHITE_ATTACKER_KEY 0x9e3779b97f4a7c15ULL
+
+// Numbers are only good for as many plies as they were found with, but a
+// mate within fewer plies holds for more, and a refutation with more for
+// fewer
+struct ProofEntry {
+    uint64_t key;
+    uint32_t pn;
+    uint32_t dn;
+    int plies;
+};
+
+// A refutation by repetition or the fifty move rule holds only for the
+// path it was found on, as does any refutation built on one. Those are
+// path dependent and stay out of the table
+typedef struct {
+    SearchMove move;
+    uint32_t pn;
+    uint32_t dn;
+    bool path_dependent;
+} ProofChild;
+
+typedef struct {
+    ProofTable *table;
+    uint64_t attacker_key;
+    Position pos;
+    long nodes;
+    long node_limit;
+    bool out_of_nodes;
+} Prover;
+
+// Sizes the table to the largest power of two entries that fit in megabytes
+ProofTable newProofTable(int megabytes)
+{
+    uint64_t entries = 1;
+    while (entries * 2 * sizeof(struct ProofEntry) <= (uint64_t)megabytes * 1024 * 1024)
+        entries *= 2;
+
+    ProofTable t = {.entries = calloc(entries, sizeof(struct ProofEntry)), .mask = entries - 1};
+    assert(t.entries != NULL && "Couldn't allocate proof table");
+    return t;
+}
+
+void freeProofTable(ProofTable *t)
+{
+    free(t->entries);
+    t->entries = NULL;
+}
+
+static uint64_t entryKey(const Prover *pr)
+{
+    return pr->pos.key ^ pr->attacker_key;
+}
+
+static bool lookup(const ProofTable *t, uint64_t key, int plies, uint32_t *pn, uint32_t *dn)
+{
+    const struct ProofEntry *e = &t->entries[key & t->mask];
+    if (e->key != key)
+        return false;
+    if ((e->pn == 0 && e->plies <= plies) || (e->dn == 0 && e->plies >= plies) || e->plies == plies) {
+        *pn = e->pn;
+        *dn = e->dn;
+        return true;
+    }
+    return false;
+}
+
+static void store(ProofTable *t, uint64_t key, int plies, uint32_t pn, uint32_t dn)
+{
+    t->entries[key & t->mask] = (struct ProofEntry){key, pn, dn, plies};
+}
+
+static uint32_t addNumbers(uint32_t a, uint32_t b)
+{
+    return (a + (uint64_t)b >= INFINITE_NUMBER) ? INFINITE_NUMBER : a + b;
+}
+
+// Starting numbers of the position on the board, with plies left to mate
+// in. The attacker moves at OR nodes and needs one good move, the defender
+// at AND nodes and needs to be mated after every move. Fewer moves to
+// choose from make a position easier to settle
+static void evaluate(Prover *pr, bool or_node, int plies, uint32_t *pn, uint32_t *dn, bool *path_dependent)
+{
+    Position *p = &pr->pos;
+    *pn = INFINITE_NUMBER;
+    *dn = 0;
+
+    // Draws are refutations, those by repetition or the fifty move rule
+    // depend on the path
+    *path_dependent = isRepetition(p) || p->halfmove_clock >= 100;
+    if (*path_dependent || insufficientMaterial(p->material))
+        return;
+    if (lookup(pr->table, entryKey(pr), plies, pn, dn))
+        return;
+
+    // Out of plies, only the mate itself counts
+    bool checked = inCheck(p);
+    if (plies == 0 && (or_node || !checked))
+        return;
+
+    // Any legal move tells a mate apart, the count of moves needn't be exact
+    SearchMove moves[256];
+    int count = generateMoves(p, moves);
+    bool legal = false;
+    for (int i = 0; i < count && !legal; i++) {
+        PositionUndo u;
+        legal = makePositionMove(p, moves[i], &u);
+        if (legal)
+            unmakePositionMove(p, moves[i], &u);
+    }
+    if (!legal) {
+        if (!or_node && checked) {
+            *pn = 0;
+            *dn = INFINITE_NUMBER;
+        }
+    }
+    else if (plies > 0) {
+        *pn = or_node ? 1 : count;
+        *dn = or_node ? count : 1;
+    }
+    store(pr->table, entryKey(pr), plies, *pn, *dn);
+}
+
+static int expand(Prover *pr, bool or_node, int plies, ProofChild *children)
+{
+    Position *p = &pr->pos;
+    SearchMove moves[256];
+    int count = generateMoves(p, moves);
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        PositionUndo u;
+        if (!makePositionMove(p, moves[i], &u))
+            continue;
+        ProofChild *c = &children[n++];
+        c->move = moves[i];
+        evaluate(pr, !or_node, plies - 1, &c->pn, &c->dn, &c->path_dependent);
+        unmakePositionMove(p, moves[i], &u);
+    }
+
+    pr->nodes += n;
+    if (pr->node_limit > 0 && pr->nodes >= pr->node_limit)
+        pr->out_of_nodes = true;
+    return n;
+}
+
+// Works on the position until its numbers reach a threshold: the proof or
+// refutation got too costly to go on with here, or it is found
+static void mid(Prover *pr, bool or_node, int plies, uint32_t th_pn, uint32_t th_dn, uint32_t *pn, uint32_t *dn,
+                bool *path_dependent)
+{
+    ProofChild children[256];
+    int count = expand(pr, or_node, plies, children);
+
+    while (true) {
+        // OR nodes are proven by any child and refuted by all, AND nodes
+        // the other way around. The best child has the smallest number to
+        // settle, the second best bounds how long it is worked on
+        int best = 0;
+        uint32_t second = INFINITE_NUMBER;
+        uint32_t any = INFINITE_NUMBER;
+        uint32_t all = 0;
+        for (int i = 0; i < count; i++) {
+            uint32_t settle = or_node ? children[i].pn : children[i].dn;
+            uint32_t other = or_node ? children[i].dn : children[i].pn;
+            all = addNumbers(all, other);
+            if (settle < any) {
+                second = any;
+                any = settle;
+                best = i;
+            }
+            else if (settle < second) {
+                second = settle;
+            }
+        }
+        *pn = or_node ? any : all;
+        *dn = or_node ? all : any;
+        if (*pn >= th_pn || *dn >= th_dn || *pn == 0 || *dn == 0 || pr->out_of_nodes)
+            break;
+
+        // The best child is worked on until it is no longer best, or its
+        // share of the other number would reach this node's threshold
+        ProofChild *c = &children[best];
+        uint32_t th_settle = or_node ? th_pn : th_dn;
+        uint32_t th_other = or_node ? th_dn : th_pn;
+        uint32_t child_settle = (th_settle < second + 1) ? th_settle : second + 1;
+        uint32_t child_other = addNumbers(th_other - (or_node ? *dn : *pn), or_node ? c->dn : c->pn);
+
+        PositionUndo u;
+        makePositionMove(&pr->pos, c->move, &u);
+        if (or_node)
+            mid(pr, false, plies - 1, child_settle, child_other, &c->pn, &c->dn, &c->path_dependent);
+        else
+            mid(pr, true, plies - 1, child_other, child_settle, &c->pn, &c->dn, &c->path_dependent);
+        unmakePositionMove(&pr->pos, c->move, &u);
+    }
+
+    // Refuted through any path dependent refutation, the refutation may
+    // be one too. Mates never rest on draws
+    *path_dependent = false;
+    for (int i = 0; i < count && *dn == 0; i++)
+        *path_dependent = *path_dependent || (children[i].dn == 0 && children[i].path_dependent);
+    if (!*path_dependent)
+        store(pr->table, entryKey(pr), plies, *pn, *dn);
+}
+
+// Whether the position on the board is a mate within plies
+static bool proven(Prover *pr, bool or_node, int plies)
+{
+    uint32_t pn, dn;
+    bool path_dependent;
+    evaluate(pr, or_node, plies, &pn, &dn, &path_dependent);
+    while (pn != 0 && dn != 0 && !pr->out_of_nodes)
+        mid(pr, or_node, plies, INFINITE_NUMBER, INFINITE_NUMBER, &pn, &dn, &path_dependent);
+    return pn == 0;
+}
+
+// Follows a proof of mate within plies: the attacker mates as quickly as
+// it can, the defender holds out as long as it can
+static int proofLine(Prover *pr, int plies, SearchMove *line)
+{
+    Position *p = &pr->pos;
+    int length = 0;
+    bool or_node = true;
+    while (plies > 0) {
+        SearchMove moves[256];
+        int count = generateLegalMoves(p, moves);
+        SearchMove chosen = {0};
+        int chosen_plies = or_node ? plies : -1;
+        for (int i = 0; i < count; i++) {
+            PositionUndo u;
+            makePositionMove(p, moves[i], &u);
+            for (int r = !or_node; r < plies; r += 2) {
+                if (!proven(pr, !or_node, r))
+                    continue;
+                if (or_node ? r < chosen_plies : r > chosen_plies) {
+                    chosen = moves[i];
+                    chosen_plies = r;
+                }
+                break;
+            }
+            unmakePositionMove(p, moves[i], &u);
+        }
+        if (chosen_plies < 0 || chosen_plies >= plies || pr->out_of_nodes)
+            break;
+
+        PositionUndo u;
+        makePositionMove(p, chosen, &u);
+        line[length++] = chosen;
+        plies = chosen_plies;
+        or_node = !or_node;
+    }
+    return length;
+}
+
+// Looks for a mate of the side to move in root, in 1 move, then 2 and so
+// on up to max_moves, so a found mate is the quickest. node_limit caps the
+// positions visited, 0 for no limit
+ProofResult proveMate(ProofTable *t, const Position *root, int max_moves, long node_limit)
+{
+    Prover *pr = malloc(sizeof(Prover));
+    assert(pr != NULL && "Couldn't allocate prover");
+    pr->table = t;
+    pr->attacker_key = (root->turn == white) ? WHITE_ATTACKER_KEY : 0;
+    pr->pos = *root;
+    pr->nodes = 0;
+    pr->node_limit = node_limit;
+    pr->out_of_nodes = false;
+
+    ProofResult r = {0};
+    double started = clockSeconds();
+    if (max_moves > MAX_MATE_MOVES)
+        max_moves = MAX_MATE_MOVES;
+    for (int moves = 1; moves <= max_moves && !pr->out_of_nodes; moves++) {
+        if (proven(pr, true, moves * 2 - 1)) {
+            r.mate = moves;
+            r.line_length = proofLine(pr, moves * 2 - 1, r.line);
+            break;
+        }
+    }
+
+    r.out_of_nodes = pr->out_of_nodes;
+    r.nodes = pr->nodes;
+    r.seconds = clockSeconds() - started;
+    free(pr);
+    return r;
+}
@@ -0,0 +1,29 @@
+#ifndef PROOF_H
+#define PROOF_H
+
+#include "position.h"
+
+// Forced mates proven by depth-first proof-number search (df-pn). Each
+// prover owns its table, so threads can prove puzzles side by side
+
+#define MAX_MATE_MOVES 32
+
+typedef struct {
+    struct ProofEntry *entries;
+    uint64_t mask;                          // entries - 1, a power of two
+} ProofTable;
+
+typedef struct {
+    int mate;                               // moves to the mate, 0 if none was proven
+    bool out_of_nodes;                      // gave up before knowing
+    SearchMove line[MAX_MATE_MOVES * 2];    // quickest mate against the longest defence
+    int line_length;
+    long nodes;
+    double seconds;
+} ProofResult;
+
+ProofTable newProofTable(int megabytes);
+void freeProofTable(ProofTable *t);
+ProofResult proveMate(ProofTable *t, const Position *root, int max_moves, long node_limit);
+
+#endif // PROOF_H
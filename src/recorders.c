@@ -1,283 +1,606 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "recorders.h"
+#include "attacks.h"
 #include "fillers.h"
+#include "masks.h"
+#include "material.h"
+#include "memo.h"
+#include "openings.h"
+#include "squares.h"
 #include "tools.h"
+#include "zobrist.h"
 
-// Records changes in castling rights when a move is made
+#ifdef VERIFY_LEGAL_MOVES
+#include "workers.h"
+#endif
+
+// Records changes in castling rights when a move is made. Cells of kings
+// and rooks with rights clear them in castling_rights_kept, whatever moves
+// from or onto them
 void recordCastlingRightChanges(Move m, Board *b)
 {
-    V2 si = m.src->idx;
-    V2 di = m.dst->idx;
-    enum PieceType stype = m.src->piece.type;
-    enum PieceType dtype = m.dst->piece.type;
-    enum PieceColor scolor = m.src->piece.color;
-    enum PieceColor dcolor = m.dst->piece.color;
-
-    // King moves
-    if (stype == king) {
-        b->queenside_castle_available[scolor] = false;
-        b->kingside_castle_available[scolor] = false;
-    }
-
-    // Rook moves
-    if (stype == rook && si.x == 0)
-        b->queenside_castle_available[scolor] = false;
-    if (stype == rook && si.x == 7)
-        b->kingside_castle_available[scolor] = false;
-
-    // Rook capture
-    if (dtype == rook && di.x == 0)
-        b->queenside_castle_available[dcolor] = false;
-    if (dtype == rook && di.x == 7)
-        b->kingside_castle_available[dcolor] = false;
+    b->castling_rights &= b->castling_rights_kept[cellSq(m.src)] &
+                          b->castling_rights_kept[cellSq(m.dst)];
 }
 
 void recordStateChangesAfterMove(Board *b)
 {
-    recordDangerousCells(b);
-    recordPins(b, b->turn);
+#ifdef VERIFY_LEGAL_MOVES
+    if (b->material != materialSignature(b))
+        assert(0 && "Kept material differs from a full count");
+#endif
+
+    recordMasks(b);
+    recordCheckSquares(b);
+    recordCheckers(b);
+    if (!recordOpeningState(b)) {
+        uint64_t key = memoKey(b);
+        if (!recordMemoState(b, key)) {
+            recordLegalMoves(b);
+            recordDangerousCells(b);
+            memoizeState(b, key);
+        }
+    }
     recordCheck(b);
+    recordPositionKey(b);
     recordDraw(b);  // should be called after others
 }
 
-// Record cells that will become dangerous to opponent
-void recordDangerousCells(Board *b)
+// Records piece placement as masks for the mask based rule queries, and
+// cells whose piece changed for recordLegalMoves
+void recordMasks(Board *restrict b)
 {
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            b->cells[y][x].is_dangerous[black] = false;
-            b->cells[y][x].is_dangerous[white] = false;
+    Mask before[2][6];
+    for (int c = 0; c < 2; c++) {
+        b->occupied[c] = 0;
+        for (int t = 0; t < 6; t++) {
+            before[c][t] = b->pieces[c][t];
+            b->pieces[c][t] = 0;
         }
     }
 
     for (int y = 0; y < 8; y++) {
         for (int x = 0; x < 8; x++) {
-            Cell c = b->cells[y][x];
-            if (emptyCell(c))
+            Piece p = b->cells[y][x].piece;
+            if (p.type == no_type)
                 continue;
+            b->pieces[p.color][p.type] |= BIT(SQ(x, y));
+            b->occupied[p.color] |= BIT(SQ(x, y));
+        }
+    }
 
-            enum PieceColor opposing = (c.piece.color == black) ? white : black;
+    Mask changed = 0;
+    for (int c = 0; c < 2; c++)
+        for (int t = 0; t < 6; t++)
+            changed |= before[c][t] ^ b->pieces[c][t];
+    b->moves_changed[black] |= changed;
+    b->moves_changed[white] |= changed;
+}
 
-            // Handle pawns differently
-            if (c.piece.type == pawn) {
-                recordDangerousCellsByPawn(x, y, b);
-                continue;
-            }
+// Records cells from where each piece type of the side to move would check
+// the opponent king, and pieces that uncover a check by moving away.
+// Should be called after recordMasks
+void recordCheckSquares(Board *restrict b)
+{
+    enum PieceColor us = b->turn;
+    enum PieceColor them = (us == black) ? white : black;
 
-            // Simulate touching the piece using a temporary board
-            // Find cells that are in range, those cells will be dangerous
-            // for opponent to enter
-            Board tmp = *b;
-            tmp.turn = c.piece.color;
-            tmp.move_pending = false;
-            fillCellsInRange(c, &tmp);
-
-            for (int i = 0; i < 8; i++) {
-                for (int j = 0; j < 8; j++) {
-                    if (tmp.cells[i][j].in_range)
-                        b->cells[i][j].is_dangerous[opposing] = true;
-                }
-            }
-        }
+    for (int t = 0; t < 6; t++)
+        b->check_squares[t] = 0;
+    b->discovered_checkers = 0;
+    b->opponent_king_sq = -1;
+
+    if (!b->pieces[them][king])
+        return;
+
+    int ksq = lsb(b->pieces[them][king]);
+    Mask occupied = b->occupied[black] | b->occupied[white];
+    b->opponent_king_sq = ksq;
+    b->check_squares[pawn] = pawnAttacks(them, ksq);
+    b->check_squares[knight] = knightAttacks(ksq);
+    b->check_squares[bishop] = bishopAttacks(ksq, occupied);
+    b->check_squares[rook] = rookAttacks(ksq, occupied);
+    b->check_squares[queen] = b->check_squares[bishop] | b->check_squares[rook];
+
+    Mask orthogonal = b->pieces[us][rook] | b->pieces[us][queen];
+    Mask diagonal = b->pieces[us][bishop] | b->pieces[us][queen];
+    b->discovered_checkers = sliderBlockers(ksq, orthogonal, diagonal, occupied) & b->occupied[us];
+}
+
+// Records pieces checking the side to move and its pinned pieces.
+// Should be called after recordMasks
+void recordCheckers(Board *restrict b)
+{
+    enum PieceColor us = b->turn;
+    enum PieceColor them = (us == black) ? white : black;
+
+    b->checkers = 0;
+    b->pinned = 0;
+    b->king_sq = -1;
+
+    if (!b->pieces[us][king])
+        return;
+
+    int ksq = lsb(b->pieces[us][king]);
+    Mask occupied = b->occupied[black] | b->occupied[white];
+    Mask orthogonal = b->pieces[them][rook] | b->pieces[them][queen];
+    Mask diagonal = b->pieces[them][bishop] | b->pieces[them][queen];
+    b->king_sq = ksq;
+    b->checkers = attackersTo(b, ksq, occupied) & b->occupied[them];
+    b->pinned = sliderBlockers(ksq, orthogonal, diagonal, occupied) & b->occupied[us];
+}
+
+// Notes what legal moves of the side to move were recorded against, for
+// the next recordLegalMoves
+static void markLegalMovesRecorded(Board *restrict b)
+{
+    enum PieceColor us = b->turn;
+
+    // Pawns beside an en passant target lose that capture next time
+    b->moves_changed[us] = b->has_en_passant_target
+                           ? BIT(SQ(b->en_passant_target_idx.x, b->en_passant_target_idx.y)) : 0;
+    b->moves_checkers[us] = b->checkers;
+    b->moves_pinned[us] = b->pinned;
+    b->moves_king_sq[us] = b->king_sq;
+}
+
+// Records legal moves of the side to move. Only pieces that a move could
+// have affected are recorded again: those with a changed cell in reach,
+// and the king. All are recorded if the check or pins changed.
+// Should be called after recordCheckers
+void recordLegalMoves(Board *restrict b)
+{
+    enum PieceColor us = b->turn;
+    Mask en_passant = b->has_en_passant_target
+                      ? BIT(SQ(b->en_passant_target_idx.x, b->en_passant_target_idx.y)) : 0;
+    Mask changed = b->moves_changed[us] | en_passant;
+    Mask pieces = b->occupied[us];
+    Mask affected = pieces & (changed | b->pieces[us][king]);
+
+    bool state_changed = b->checkers != b->moves_checkers[us] ||
+                         b->pinned != b->moves_pinned[us] ||
+                         b->king_sq != b->moves_king_sq[us];
+    if (state_changed)
+        affected = pieces;
+
+    Mask rest = pieces & ~affected;
+    while (rest) {
+        int sq = popLsb(&rest);
+        if (candidateTargets(b, sq) & changed)
+            affected |= BIT(sq);
     }
+
+    while (affected) {
+        int sq = popLsb(&affected);
+        b->legal_moves[sq] = legalTargets(b, sq);
+    }
+
+#ifdef VERIFY_LEGAL_MOVES
+    Mask all = pieces;
+    while (all) {
+        int sq = popLsb(&all);
+        if (b->legal_moves[sq] != legalTargets(b, sq))
+            assert(0 && "Recorded legal moves differ from full recomputation");
+    }
+#endif
+
+    markLegalMovesRecorded(b);
 }
 
-void recordDangerousCellsByPawn(int x, int y, Board *b)
+// Sets is_dangerous of cells from masks by king color
+static void storeDangerousMasks(Board *restrict b, const Mask dangerous[2])
 {
-    // Pawn captures only diagonals, thus threatens only diagonals
-    Cell touched = b->cells[y][x];
-    int dir = (touched.piece.color == black) ? 1 : -1;
-    int j = y + dir;
-    int xl = x - 1;
-    int xr = x + 1;
-    enum PieceColor dangerous_for = touched.piece.color == black ? white : black;
-    if (validCellIdx(xl, j))
-        b->cells[j][xl].is_dangerous[dangerous_for] = true;
-    if (validCellIdx(xr, j))
-        b->cells[j][xr].is_dangerous[dangerous_for] = true;
+    for (int sq = 0; sq < 64; sq++) {
+        Cell *c = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+        c->is_dangerous[black] = (dangerous[black] & BIT(sq)) != 0;
+        c->is_dangerous[white] = (dangerous[white] & BIT(sq)) != 0;
+    }
 }
 
+// Records legal moves and dangerous cells baked into the binary, if the
+// position is one of the early positions of a standard game. Should be
+// called after recordCheckers
+bool recordOpeningState(Board *restrict b)
+{
+    const OpeningEntry *e = findOpening(b);
+    if (e == NULL)
+        return false;
+
+    Mask pieces = b->occupied[b->turn];
+    while (pieces)
+        b->legal_moves[popLsb(&pieces)] = 0;
+    const OpeningMove *moves = openingMoves(e);
+    for (int k = 0; k < e->move_count; k++)
+        b->legal_moves[moves[k].from] |= BIT(moves[k].to);
+    markLegalMovesRecorded(b);
+
+    storeDangerousMasks(b, e->dangerous);
+
+#ifdef VERIFY_LEGAL_MOVES
+    Mask all = b->occupied[b->turn];
+    while (all) {
+        int sq = popLsb(&all);
+        if (b->legal_moves[sq] != legalTargets(b, sq))
+            assert(0 && "Baked legal moves differ from full recomputation");
+    }
+    recordDangerousCells(b);
+    for (int sq = 0; sq < 64; sq++)
+        for (int c = 0; c < 2; c++)
+            if (b->cells[SQ_Y(sq)][SQ_X(sq)].is_dangerous[c] != ((e->dangerous[c] & BIT(sq)) != 0))
+                assert(0 && "Baked dangerous cells differ from recomputation");
+#endif
+    return true;
+}
 
-void recordPins(Board *b, enum PieceColor color)
+// Records legal moves and dangerous cells memoized for the position under
+// key, if it was seen recently. Should be called after recordCheckers
+bool recordMemoState(Board *restrict b, uint64_t key)
 {
-    // Reset
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            b->cells[y][x].opens_check = false;
-            for (int i = 0; i < 8; i++)
-                for (int j = 0; j < 8; j++)
-                    b->cells[y][x].check_opening_cells[i][j] = false;
-        }
+    MemoState s;
+    if (popCount(b->occupied[b->turn]) > MEMO_PIECES || !findMemo(key, &s))
+        return false;
+
+    Mask pieces = b->occupied[b->turn];
+    for (int i = 0; pieces; i++)
+        b->legal_moves[popLsb(&pieces)] = s.moves[i];
+    markLegalMovesRecorded(b);
+    storeDangerousMasks(b, s.dangerous);
+
+#ifdef VERIFY_LEGAL_MOVES
+    Mask all = b->occupied[b->turn];
+    while (all) {
+        int sq = popLsb(&all);
+        if (b->legal_moves[sq] != legalTargets(b, sq))
+            assert(0 && "Memoized legal moves differ from full recomputation");
     }
+    recordDangerousCells(b);
+    for (int sq = 0; sq < 64; sq++)
+        for (int c = 0; c < 2; c++)
+            if (b->cells[SQ_Y(sq)][SQ_X(sq)].is_dangerous[c] != ((s.dangerous[c] & BIT(sq)) != 0))
+                assert(0 && "Memoized dangerous cells differ from recomputation");
+#endif
+    return true;
+}
+
+// Keeps the recorded legal moves and dangerous cells under key
+void memoizeState(const Board *restrict b, uint64_t key)
+{
+    if (popCount(b->occupied[b->turn]) > MEMO_PIECES)
+        return;
 
-    // Make a copy of board
-    Board copy = *b;
-    copy.turn = color;
+    MemoState s = {.dangerous = {0, 0}};
+    Mask pieces = b->occupied[b->turn];
+    for (int i = 0; pieces; i++)
+        s.moves[i] = b->legal_moves[popLsb(&pieces)];
+    for (int sq = 0; sq < 64; sq++)
+        for (int c = 0; c < 2; c++)
+            if (b->cells[SQ_Y(sq)][SQ_X(sq)].is_dangerous[c])
+                s.dangerous[c] |= BIT(sq);
+    storeMemo(key, &s);
+}
 
-    // Locate king's position
-    V2 king_idx = {.x = -1, .y = -1};
+// Record cells that will become dangerous to opponent. Byte planes where
+// the cpu has them, walking each piece's range otherwise
+void recordDangerousCells(Board *restrict b)
+{
+#ifdef ATTACKS_HAVE_PLANES
+    storeDangerousCellsByPlanes(b);
+
+#ifdef VERIFY_LEGAL_MOVES
+    Mask by_planes[2] = {0, 0};
+    for (int sq = 0; sq < 64; sq++)
+        for (int c = 0; c < 2; c++)
+            if (b->cells[SQ_Y(sq)][SQ_X(sq)].is_dangerous[c])
+                by_planes[c] |= BIT(sq);
+
+    recordDangerousCellsByRange(b);
+    for (int sq = 0; sq < 64; sq++)
+        for (int c = 0; c < 2; c++)
+            if (b->cells[SQ_Y(sq)][SQ_X(sq)].is_dangerous[c] != ((by_planes[c] & BIT(sq)) != 0))
+                assert(0 && "Dangerous cells from planes differ from piece ranges");
+#endif
+#else
+    recordDangerousCellsByRange(b);
+#endif
+}
+
+// Marks every cell in range of each piece as dangerous for its opponent
+void recordDangerousCellsByRange(Board *restrict b)
+{
     for (int y = 0; y < 8; y++) {
         for (int x = 0; x < 8; x++) {
-            Cell c = b->cells[y][x];
-            if (c.piece.type == king && c.piece.color == color) {
-                king_idx.x = x;
-                king_idx.y = y;
-                break;
-            }
+            b->cells[y][x].is_dangerous[black] = false;
+            b->cells[y][x].is_dangerous[white] = false;
         }
     }
-    if (king_idx.x == -1 || king_idx.y == -1)
-        assert(0 && "Couldn't locate king");
 
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
+    for (int sq = 0; sq < 64; sq++) {
+        const Cell *c = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+        if (emptyCell(c))
+            continue;
 
-            Cell src = copy.cells[y][x];
-            if (emptyCell(src) || src.piece.color != color || src.piece.type == king)
-                continue;
+        enum PieceColor opposing = (c->piece.color == black) ? white : black;
 
-            // Collect movable moves (dont filter check opening cells)
-            // Otherwise everything may get filtered in first try
-            Board tmp1 = copy;
-            tmp1.filter_check_opening = false;
-            tmp1.move_pending = false;
-            fillMovableCells(src, &tmp1);
-
-            for (int i = 0; i < 8; i++) {
-                for (int j = 0; j < 8; j++) {
-                    Cell dst = tmp1.cells[i][j];
-                    if (!dst.is_movable)
-                        continue;
-
-                    Board tmp2 = tmp1;
-                    movePiece(&tmp2.cells[y][x], &tmp2.cells[i][j]);
-
-                    // Move the double pushed pawn in en passant
-                    bool move_is_en_passant =
-                        src.piece.type == pawn &&
-                        tmp2.has_en_passant_target &&
-                        dst.idx.y == tmp2.en_passant_target_idx.y &&
-                        dst.idx.x == tmp2.en_passant_target_idx.x;
-                    if (move_is_en_passant) {
-                        int direction = (src.piece.color == black) ? 1 : -1;
-                        int one_backwards = dst.idx.y - direction;
-                        tmp2.cells[one_backwards][dst.idx.x].piece = (Piece){.type = no_type, .color = no_color};
-                    }
-                    recordDangerousCells(&tmp2);
-
-                    // If king is in danger after moving, cell will open check to king
-                    if (tmp2.cells[king_idx.y][king_idx.x].is_dangerous[color]) {
-                        b->cells[y][x].opens_check = true;
-                        b->cells[y][x].check_opening_cells[i][j] = true;
-                        b->filter_check_opening = true;     // filter out check opening cells in further moves
-                    }
-                }
+        // Handle pawns differently
+        if (c->piece.type == pawn) {
+            recordDangerousCellsByPawn(b, sq);
+            continue;
+        }
+
+        // King threatens only its neighbours, castling captures nothing
+        if (c->piece.type == king) {
+            Mask threatened = kingAttacks(sq);
+            while (threatened) {
+                int t = popLsb(&threatened);
+                b->cells[SQ_Y(t)][SQ_X(t)].is_dangerous[opposing] = true;
             }
+            continue;
+        }
+
+        // Cells in range of the piece are dangerous for opponent to enter.
+        // Cells in range are scratch, so the board itself can be used
+        fillCellsInRange(b, sq);
+        Mask in_range = b->in_range;
+        while (in_range) {
+            int r = popLsb(&in_range);
+            b->cells[SQ_Y(r)][SQ_X(r)].is_dangerous[opposing] = true;
         }
     }
-    return;
 }
 
-// Finds whether king is checked, and finds cells that can block the check
-void recordCheck(Board *b)
+void recordDangerousCellsByPawn(Board *restrict b, int sq)
+{
+    // Pawn captures only diagonals, thus threatens only diagonals
+    const Cell *touched = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    int dir = (touched->piece.color == black) ? 1 : -1;
+    Square l = stepSquare(toSquare(touched->idx), -1, dir);
+    Square r = stepSquare(toSquare(touched->idx), 1, dir);
+    enum PieceColor dangerous_for = touched->piece.color == black ? white : black;
+    if (onBoard(l))
+        cellAt(b, l)->is_dangerous[dangerous_for] = true;
+    if (onBoard(r))
+        cellAt(b, r)->is_dangerous[dangerous_for] = true;
+}
+
+#ifdef VERIFY_LEGAL_MOVES
+
+// Pins and check blocks found by simulating every move of a touched piece,
+// which the recorded legal moves replaced. Kept to check them against
+
+// Simulations of moving one piece to each of its movable cells, run as pool
+// jobs. Jobs only read board, and each writes just the result of its own cell
+typedef struct {
+    const Board *board;     // movable cells of the source are filled
+    V2 source;
+    V2 king_idx;
+    enum PieceColor color;
+    int count;
+    V2 targets[64];
+    bool king_dangerous[64];
+} Simulations;
+
+// Moves a piece on a scratch board, removing the double pushed pawn in en passant
+static void simulateMove(Board *tmp, V2 si, V2 di)
+{
+    Piece moved = tmp->cells[si.y][si.x].piece;
+    movePiece(&tmp->cells[si.y][si.x], &tmp->cells[di.y][di.x]);
+
+    bool move_is_en_passant =
+        moved.type == pawn &&
+        tmp->has_en_passant_target &&
+        di.y == tmp->en_passant_target_idx.y &&
+        di.x == tmp->en_passant_target_idx.x;
+    if (move_is_en_passant) {
+        int direction = (moved.color == black) ? 1 : -1;
+        int one_backwards = di.y - direction;
+        tmp->cells[one_backwards][di.x].piece = (Piece){.type = no_type, .color = no_color};
+    }
+}
+
+// Scratch boards per worker for the simulations, kept off the stack so pool
+// threads can run them on small stacks. movable is the copy of the board
+// with movable cells of the source filled, tmp the board a move is tried on
+typedef struct {
+    Board movable;
+    Board tmp;
+} Scratch;
+
+static Scratch *scratch = NULL;
+static int scratch_workers = 0;
+
+// Grows scratch memory along with the pool and returns the calling worker's
+static Scratch *workerScratch(void)
+{
+    int needed = workerCount() + 1;
+    if (needed > scratch_workers) {
+        free(scratch);
+        scratch = malloc(sizeof(Scratch) * needed);
+        if (scratch == NULL)
+            assert(0 && "Couldn't allocate scratch boards");
+        scratch_workers = needed;
+    }
+    return &scratch[currentWorker()];
+}
+
+// Simulates moving the source piece to one of its movable cells and records
+// whether its king is dangerous afterwards
+static void simulateMoveJob(void *arg, int index, int worker)
+{
+    Simulations *sims = arg;
+    Board *tmp = &scratch[worker].tmp;
+    V2 si = sims->source;
+    V2 di = sims->targets[index];
+    bool moving_king = sims->board->cells[si.y][si.x].piece.type == king;
+
+    *tmp = *sims->board;
+    simulateMove(tmp, si, di);
+    recordDangerousCells(tmp);
+
+    // If src was king, king is at dst now
+    V2 king_at = moving_king ? di : sims->king_idx;
+    sims->king_dangerous[index] = tmp->cells[king_at.y][king_at.x].is_dangerous[sims->color];
+}
+
+// Fills movable cells of the source on the copy in movable, then simulates
+// each of them across the worker pool
+static void runSimulations(Simulations *sims, Board *movable)
+{
+    V2 si = sims->source;
+    movable->move_pending = false;
+    fillMovableCells(movable, SQ(si.x, si.y));
+
+    sims->board = movable;
+    sims->count = 0;
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 8; j++)
+            if (movable->cells[i][j].is_movable)
+                sims->targets[sims->count++] = (V2){.y = i, .x = j};
+
+    runJobs(simulateMoveJob, sims, sims->count);
+}
+
+static V2 locateKing(const Board *b, enum PieceColor color)
 {
-    enum PieceColor king_color = b->turn;
-    V2 king_idx = {.x = -1, .y = -1};
-    b->king_checked = false;
-    b->filter_nonblocking_cells = false;
-    b->checked_king = NULL;
     for (int y = 0; y < 8; y++) {
         for (int x = 0; x < 8; x++) {
-            b->cells[y][x].blocks_check = false;
-            for (int i = 0; i < 8; i++)
-                for (int j = 0; j < 8; j++)
-                    b->cells[y][x].check_blocking_cells[i][j] = false;
+            Piece p = b->cells[y][x].piece;
+            if (p.type == king && p.color == color)
+                return (V2){.y = y, .x = x};
         }
     }
+    assert(0 && "Couldn't locate king");
+    return (V2){.y = -1, .x = -1};
+}
 
-    // Find if king checked
-    for (int i = 0; i < 8; i++) {
-        for (int j = 0; j < 8; j++) {
-            Cell c = b->cells[i][j];
-            if (c.piece.type == king && c.piece.color == king_color && c.is_dangerous[king_color]) {
-                b->king_checked = true;
-                b->checked_king = &(b->cells[i][j]);
-                b->filter_nonblocking_cells = true;
-                king_idx.y = i;
-                king_idx.x = j;
-            }
-        }
+// Records pins and check blocks of the piece on sq
+void recordPieceState(Board *b, int sq)
+{
+    Cell *c = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    c->opens_check = false;
+    c->blocks_check = false;
+    c->check_opening_cells = 0;
+    c->check_blocking_cells = 0;
+
+    if (!emptyCell(c) && c->piece.color == b->turn) {
+        if (c->piece.type != king)
+            recordPins(b, sq);
+        if (b->king_checked)
+            recordCheckBlocks(b, sq);
     }
+}
 
-    if (!b->king_checked)
-        return;
+// Records cells the piece on sq can't move to without exposing its king
+void recordPins(Board *b, int sq)
+{
+    enum PieceColor color = b->cells[SQ_Y(sq)][SQ_X(sq)].piece.color;
+    Simulations sims = {
+        .source = {.y = SQ_Y(sq), .x = SQ_X(sq)},
+        .king_idx = locateKing(b, color),
+        .color = color,
+    };
+
+    // Collect movable moves (dont filter check opening or non blocking cells)
+    // Otherwise everything may get filtered in first try
+    Board *movable = &workerScratch()->movable;
+    *movable = *b;
+    movable->filter_check_opening = false;
+    movable->filter_nonblocking_cells = false;
+    runSimulations(&sims, movable);
+
+    // If king is in danger after moving, cell will open check to king
+    Cell *c = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    for (int k = 0; k < sims.count; k++) {
+        if (!sims.king_dangerous[k])
+            continue;
+        V2 di = sims.targets[k];
+        c->opens_check = true;
+        c->check_opening_cells |= BIT(SQ(di.x, di.y));
+        b->filter_check_opening = true;     // filter out check opening cells in further moves
+    }
+}
 
-    // Find cells that will block the check
-    // Simulate moving all pieces to each of their movable cells
-    // If that makes the king safe, that moved cell blocks the check
-    bool can_be_blocked = false;
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
+// Records cells the piece on sq can move to for getting its king out of check
+void recordCheckBlocks(Board *b, int sq)
+{
+    enum PieceColor color = b->cells[SQ_Y(sq)][SQ_X(sq)].piece.color;
+    Simulations sims = {
+        .source = {.y = SQ_Y(sq), .x = SQ_X(sq)},
+        .king_idx = locateKing(b, color),
+        .color = color,
+    };
+
+    // Collect movable moves (dont filter non blocking moves)
+    // Otherwise everything may get filtered in first try
+    Board *movable = &workerScratch()->movable;
+    *movable = *b;
+    movable->filter_nonblocking_cells = false;
+    runSimulations(&sims, movable);
+
+    // If king is safe now, src blocks the check
+    Cell *c = &(b->cells[SQ_Y(sq)][SQ_X(sq)]);
+    for (int k = 0; k < sims.count; k++) {
+        if (sims.king_dangerous[k])
+            continue;
+        V2 di = sims.targets[k];
+        c->blocks_check = true;
+        c->check_blocking_cells |= BIT(SQ(di.x, di.y));
+    }
+}
 
-            Cell src = b->cells[y][x];
-            if (emptyCell(src))
-                continue;
+#endif // VERIFY_LEGAL_MOVES
 
-            if (src.piece.color != king_color)
-                continue;
+// Finds whether king is checked, and whether that is a checkmate
+void recordCheck(Board *b)
+{
+    enum PieceColor king_color = b->turn;
+    b->king_checked = false;
+#ifdef VERIFY_LEGAL_MOVES
+    b->filter_nonblocking_cells = false;
+#endif
+    b->checked_king = NULL;
 
-            // Collect movable moves (dont filter non blocking moves)
-            // Otherwise everything may get filtered in first try
-            Board tmp1 = *b;
-            tmp1.move_pending = false;
-            tmp1.filter_nonblocking_cells = false;
-            fillMovableCells(src, &tmp1);
-
-            for (int i = 0; i < 8; i++) {
-                for (int j = 0; j < 8; j++) {
-
-                    Cell dst = tmp1.cells[i][j];
-                    if (!dst.is_movable)
-                        continue;
-
-                    Board tmp2 = tmp1;
-                    movePiece(&tmp2.cells[y][x], &tmp2.cells[i][j]);
-
-                    // Move the double pushed pawn in en passant
-                    bool move_is_en_passant =
-                        src.piece.type == pawn &&
-                        tmp2.has_en_passant_target &&
-                        dst.idx.y == tmp2.en_passant_target_idx.y &&
-                        dst.idx.x == tmp2.en_passant_target_idx.x;
-                    if (move_is_en_passant) {
-                        int direction = (src.piece.color == black) ? 1 : -1;
-                        int one_backwards = dst.idx.y - direction;
-                        tmp2.cells[one_backwards][dst.idx.x].piece = (Piece){.type = no_type, .color = no_color};
-                    }
-                    recordDangerousCells(&tmp2);
-
-                    // If king is safe now, src blocks the check
-                    // If src was king, king is at (i, j) now
-                    V2 king_at = (src.piece.type == king) ? (V2){.y = i, .x = j} : king_idx;
-                    bool king_safe = !tmp2.cells[king_at.y][king_at.x].is_dangerous[king_color];
-                    if (king_safe) {
-                        can_be_blocked = true;
-                        b->cells[y][x].blocks_check = true;
-                        b->cells[y][x].check_blocking_cells[i][j] = true;
-                    }
-                }
-            }
-        }
+    Cell *king_cell = (b->king_sq != -1) ? &(b->cells[SQ_Y(b->king_sq)][SQ_X(b->king_sq)]) : NULL;
+    if (king_cell != NULL && king_cell->is_dangerous[king_color]) {
+        b->king_checked = true;
+        b->checked_king = king_cell;
+#ifdef VERIFY_LEGAL_MOVES
+        b->filter_nonblocking_cells = true;
+#endif
     }
 
-    if (!can_be_blocked)
+    if (b->king_checked && !hasLegalMove(b))
         b->checkmate = true;
 }
 
-// Records if game has drawn, should be called after recording checks, pins, etc
+// Records the key of the position in the history, at its halfmove clock.
+// Capturing or pawn moves reset the clock, so older keys that can't repeat
+// get overwritten
+void recordPositionKey(Board *b)
+{
+    if (b->halfmove_clock < KEY_HISTORY_SIZE)
+        b->key_history[b->halfmove_clock] = positionKey(b);
+}
+
+// Counts earlier occurrences of the position since the last capture or pawn
+// move. Only every second key has the same side to move
+static int countRepetitions(const Board *b)
+{
+    if (b->halfmove_clock >= KEY_HISTORY_SIZE)
+        return 0;
+
+    uint64_t key = b->key_history[b->halfmove_clock];
+    int count = 0;
+    for (int i = (int)b->halfmove_clock - 2; i >= 0; i -= 2)
+        count += b->key_history[i] == key;
+    return count;
+}
+
+// Records if game has drawn, should be called after recording checks
 void recordDraw(Board *b)
 {
     if (b->checkmate)
@@ -289,31 +612,24 @@ void recordDraw(Board *b)
         return;
     }
 
-    // Stalemate if no movable cells remain
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            Cell src = b->cells[y][x];
-            if (src.piece.color != b->turn || emptyCell(src))
-                continue;
-
-            Board unmoved = *b;
-            unmoved.move_pending = false;
-            fillMovableCells(src, &unmoved);
+    // Stalemate if no legal move remains
+    if (!b->king_checked && !hasLegalMove(b)) {
+        b->draw_by_stalemate = true;
+        return;
+    }
 
-            for (int i = 0; i < 8; i++) {
-                for (int j = 0; j < 8; j++) {
-                    if (unmoved.cells[i][j].is_movable) {
-                        goto no_stalemate;
-                    }
-                }
-            }
-        }
+    // Neither side has the pieces to mate
+    if (insufficientMaterial(b->material)) {
+        b->draw_by_insufficient_material = true;
+        return;
     }
 
-    b->draw_by_stalemate = true;
-    return;
+    // Draw by threefold repetition
+    if (countRepetitions(b) >= 2) {
+        b->draw_by_repetition = true;
+        return;
+    }
 
-    no_stalemate:
     // TODO: impelment other forms of draw
     // https://www.chess.com/article/view/how-chess-games-can-end-8-ways-explained
     return;
@@ -5,10 +5,23 @@
 
 void recordCastlingRightChanges(Move m, Board *b);
 void recordStateChangesAfterMove(Board *b);
-void recordDangerousCells(Board *b);
-void recordDangerousCellsByPawn(int x, int y, Board *b);
+void recordMasks(Board *restrict b);
+void recordCheckSquares(Board *restrict b);
+void recordCheckers(Board *restrict b);
+void recordLegalMoves(Board *restrict b);
+bool recordOpeningState(Board *restrict b);
+bool recordMemoState(Board *restrict b, uint64_t key);
+void memoizeState(const Board *restrict b, uint64_t key);
+void recordDangerousCells(Board *restrict b);
+void recordDangerousCellsByRange(Board *restrict b);
+void recordDangerousCellsByPawn(Board *restrict b, int sq);
 void recordCheck(Board *b);
-void recordPins(Board *b, enum PieceColor color);
+#ifdef VERIFY_LEGAL_MOVES
+void recordPieceState(Board *b, int sq);
+void recordPins(Board *b, int sq);
+void recordCheckBlocks(Board *b, int sq);
+#endif
+void recordPositionKey(Board *b);
 void recordDraw(Board *b);
 
 #endif // RECORDERS_H
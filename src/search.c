@@ -0,0 +1,693 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "search.h"
+#include "masks.h"
+#include "material.h"
+#include "tools.h"
+
+// Node counts between looks at the clock and the stop flag
+#define CHECK_INTERVAL      2048
+#define PROGRESS_INTERVAL   (CHECK_INTERVAL * 32)
+
+// Helper threads recurse with their move lists on the stack, as the
+// engine thread does
+#define HELPER_STACK_SIZE (1024 * 1024)
+
+enum Bound {
+    no_bound,
+    upper_bound,
+    lower_bound,
+    exact_bound,
+};
+
+// Threads of a search read and write entries without locks. An entry holds
+// its key xor its data, so an entry torn by two writers fails the key
+// check instead of handing out another position's data
+typedef struct TableEntry {
+    _Atomic uint64_t check;     // key ^ data
+    _Atomic uint64_t data;      // see packEntry
+} TableEntry;
+
+typedef struct {
+    SearchMove move;
+    int score;
+    int depth;
+    enum Bound bound;
+} TableData;
+
+// Table of searches whose limits name none, sized by setTableSize
+static SearchTable default_table = {NULL, 0};
+
+// State shared by the threads of one search
+typedef struct {
+    atomic_bool stop;
+    atomic_long nodes;      // all threads, added every CHECK_INTERVAL nodes
+} SearchShared;
+
+typedef struct {
+    Position pos;
+    SearchLimits limits;
+    SearchShared *shared;
+    SearchTable *table;
+    int id;                             // 0 for the thread that reports
+    SearchMove excluded[MAX_MULTI_PV];  // root moves of lines found at this depth
+    int excluded_count;
+    double started;
+    bool stopped;
+    long nodes;
+    SearchMove killers[MAX_PLY][2];
+    int history[2][64][64];             // by color, from and to, raised by quiet cutoffs
+    SearchMove pv[MAX_PLY][MAX_PLY];    // by ply, best line found from there
+    int pv_length[MAX_PLY];
+    SearchProgress progress;
+    void *arg;
+    SearchReport report;
+} Searcher;
+
+static const SearchMove no_move = {0, 0, no_type, quiet_move};
+
+// By piece type, in order with enum PieceType
+static const int piece_values[6] = {0, 900, 330, 320, 500, 100};
+
+// Piece cell tables for white, top left is a8. Black looks them up mirrored
+static const int8_t cell_values[6][64] = {
+    [queen] = {
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,   5,   5,   5,   0, -10,
+         -5,   0,   5,   5,   5,   5,   0,  -5,
+          0,   0,   5,   5,   5,   5,   0,  -5,
+        -10,   5,   5,   5,   5,   5,   0, -10,
+        -10,   0,   5,   0,   0,   0,   0, -10,
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+    },
+    [bishop] = {
+        -20, -10, -10, -10, -10, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,  10,  10,   5,   0, -10,
+        -10,   5,   5,  10,  10,   5,   5, -10,
+        -10,   0,  10,  10,  10,  10,   0, -10,
+        -10,  10,  10,  10,  10,  10,  10, -10,
+        -10,   5,   0,   0,   0,   0,   5, -10,
+        -20, -10, -10, -10, -10, -10, -10, -20,
+    },
+    [knight] = {
+        -50, -40, -30, -30, -30, -30, -40, -50,
+        -40, -20,   0,   0,   0,   0, -20, -40,
+        -30,   0,  10,  15,  15,  10,   0, -30,
+        -30,   5,  15,  20,  20,  15,   5, -30,
+        -30,   0,  15,  20,  20,  15,   0, -30,
+        -30,   5,  10,  15,  15,  10,   5, -30,
+        -40, -20,   0,   5,   5,   0, -20, -40,
+        -50, -40, -30, -30, -30, -30, -40, -50,
+    },
+    [rook] = {
+          0,   0,   0,   0,   0,   0,   0,   0,
+          5,  10,  10,  10,  10,  10,  10,   5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+          0,   0,   0,   5,   5,   0,   0,   0,
+    },
+    [pawn] = {
+          0,   0,   0,   0,   0,   0,   0,   0,
+         50,  50,  50,  50,  50,  50,  50,  50,
+         10,  10,  20,  30,  30,  20,  10,  10,
+          5,   5,  10,  25,  25,  10,   5,   5,
+          0,   0,   0,  20,  20,   0,   0,   0,
+          5,  -5, -10,   0,   0, -10,  -5,   5,
+          5,  10,  10, -20, -20,  10,  10,   5,
+          0,   0,   0,   0,   0,   0,   0,   0,
+    },
+};
+
+// The king hides while queens and rooks are about, and walks out after
+static const int8_t king_middle_values[64] = {
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -20, -30, -30, -40, -40, -30, -30, -20,
+    -10, -20, -20, -20, -20, -20, -20, -10,
+     20,  20,   0,   0,   0,   0,  20,  20,
+     20,  30,  10,   0,   0,  10,  30,  20,
+};
+
+static const int8_t king_end_values[64] = {
+    -50, -40, -30, -20, -20, -30, -40, -50,
+    -30, -20, -10,   0,   0, -10, -20, -30,
+    -30, -10,  20,  30,  30,  20, -10, -30,
+    -30, -10,  30,  40,  40,  30, -10, -30,
+    -30, -10,  30,  40,  40,  30, -10, -30,
+    -30, -10,  20,  30,  30,  20, -10, -30,
+    -30, -30,   0,   0,   0,   0, -30, -30,
+    -50, -30, -30, -30, -30, -30, -30, -50,
+};
+
+// Phase weights of pieces other than pawns, 24 with all of them on board
+static const int phase_weights[6] = {0, 4, 1, 1, 2, 0};
+#define FULL_PHASE 24
+
+void initSearch(void)
+{
+    if (default_table.entries == NULL)
+        setTableSize(DEFAULT_TABLE_MB);
+}
+
+// Sizes a table to the largest power of two entries that fit in megabytes
+SearchTable newSearchTable(int megabytes)
+{
+    uint64_t entries = 1;
+    while (entries * 2 * sizeof(TableEntry) <= (uint64_t)megabytes * 1024 * 1024)
+        entries *= 2;
+
+    SearchTable t = {.entries = calloc(entries, sizeof(TableEntry)), .mask = entries - 1};
+    assert(t.entries != NULL && "Couldn't allocate transposition table");
+    return t;
+}
+
+void freeSearchTable(SearchTable *t)
+{
+    free(t->entries);
+    t->entries = NULL;
+}
+
+void clearSearchTable(SearchTable *t)
+{
+    if (t->entries != NULL)
+        memset(t->entries, 0, sizeof(TableEntry) * (t->mask + 1));
+}
+
+// Resizes the default table, forgetting what it held. Not to be called
+// while searching
+void setTableSize(int megabytes)
+{
+    freeSearchTable(&default_table);
+    default_table = newSearchTable(megabytes);
+}
+
+// Forgets positions of an earlier game
+void clearSearch(void)
+{
+    clearSearchTable(&default_table);
+}
+
+// Material and piece cells, in centipawns for the side to move
+int evaluate(const Position *p)
+{
+    int score = 0;
+    int phase = 0;
+    for (int c = 0; c < 2; c++) {
+        int sign = (c == white) ? 1 : -1;
+        int mirror = (c == white) ? 0 : 56;
+        for (int t = queen; t <= pawn; t++) {
+            Mask pieces = p->pieces[c][t];
+            while (pieces) {
+                int sq = popLsb(&pieces);
+                score += sign * (piece_values[t] + cell_values[t][sq ^ mirror]);
+                phase += phase_weights[t];
+            }
+        }
+    }
+    if (phase > FULL_PHASE)
+        phase = FULL_PHASE;
+
+    for (int c = 0; c < 2; c++) {
+        if (p->king_sq[c] < 0)
+            continue;
+        int sq = p->king_sq[c] ^ ((c == white) ? 0 : 56);
+        int king = (king_middle_values[sq] * phase + king_end_values[sq] * (FULL_PHASE - phase)) / FULL_PHASE;
+        score += (c == white) ? king : -king;
+    }
+    return (p->turn == white) ? score : -score;
+}
+
+// Moves to the mate a score stands for, negative when the side to move gets
+// mated, 0 for scores that aren't mates
+int mateIn(int score)
+{
+    if (score > MATE_BOUND)
+        return (MATE_SCORE - score + 1) / 2;
+    if (score < -MATE_BOUND)
+        return -(MATE_SCORE + score + 1) / 2;
+    return 0;
+}
+
+long nodesPerSecond(const SearchReport *r)
+{
+    return (r->seconds > 0) ? (long)(r->nodes / r->seconds) : 0;
+}
+
+// Mate scores are kept relative to the position, not the root
+static int scoreToTable(int score, int ply)
+{
+    if (score > MATE_BOUND)
+        return score + ply;
+    if (score < -MATE_BOUND)
+        return score - ply;
+    return score;
+}
+
+static int scoreFromTable(int score, int ply)
+{
+    if (score > MATE_BOUND)
+        return score - ply;
+    if (score < -MATE_BOUND)
+        return score + ply;
+    return score;
+}
+
+// Move in the low 18 bits, then score, depth and bound
+static uint64_t packEntry(TableData d)
+{
+    return (uint64_t)d.move.from | (uint64_t)d.move.to << 6 |
+           (uint64_t)d.move.promotion << 12 | (uint64_t)d.move.kind << 15 |
+           (uint64_t)(uint16_t)d.score << 18 | (uint64_t)(uint8_t)d.depth << 34 |
+           (uint64_t)d.bound << 42;
+}
+
+static TableData unpackEntry(uint64_t data)
+{
+    TableData d;
+    d.move = (SearchMove){data & 63, (data >> 6) & 63, (data >> 12) & 7, (data >> 15) & 7};
+    d.score = (int16_t)(uint16_t)(data >> 18);
+    d.depth = (int8_t)(uint8_t)(data >> 34);
+    d.bound = (data >> 42) & 3;
+    return d;
+}
+
+static bool probeEntry(const SearchTable *t, uint64_t key, TableData *out)
+{
+    TableEntry *e = &t->entries[key & t->mask];
+    uint64_t data = atomic_load_explicit(&e->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&e->check, memory_order_relaxed);
+    if ((check ^ data) != key)
+        return false;
+    *out = unpackEntry(data);
+    return true;
+}
+
+static void storeEntry(SearchTable *t, uint64_t key, SearchMove m, int score, int depth, enum Bound bound, int ply)
+{
+    TableData old;
+    if (probeEntry(t, key, &old) && old.depth > depth && bound != exact_bound)
+        return;
+
+    TableData d = {.move = m, .score = scoreToTable(score, ply), .depth = depth, .bound = bound};
+    uint64_t data = packEntry(d);
+    TableEntry *e = &t->entries[key & t->mask];
+    atomic_store_explicit(&e->data, data, memory_order_relaxed);
+    atomic_store_explicit(&e->check, key ^ data, memory_order_relaxed);
+}
+
+// The reporting thread watches the clock and the caller's stop flag, and
+// stops the others through the shared one
+static void checkLimits(Searcher *s)
+{
+    atomic_fetch_add_explicit(&s->shared->nodes, CHECK_INTERVAL, memory_order_relaxed);
+
+    if (s->id == 0) {
+        double elapsed = clockSeconds() - s->started;
+        if ((s->limits.stop != NULL && atomic_load(s->limits.stop)) ||
+            (s->limits.millis > 0 && elapsed * 1000 >= s->limits.millis) ||
+            (s->limits.nodes > 0 && atomic_load(&s->shared->nodes) >= s->limits.nodes))
+            atomic_store(&s->shared->stop, true);
+
+        if (s->progress != NULL && s->nodes % PROGRESS_INTERVAL == 0) {
+            s->report.nodes = atomic_load(&s->shared->nodes);
+            s->report.seconds = elapsed;
+            s->progress(&s->report, s->arg);
+        }
+    }
+    if (atomic_load_explicit(&s->shared->stop, memory_order_relaxed))
+        s->stopped = true;
+}
+
+static bool isExcluded(const Searcher *s, SearchMove m)
+{
+    for (int i = 0; i < s->excluded_count; i++)
+        if (sameMove(m, s->excluded[i]))
+            return true;
+    return false;
+}
+
+static bool isCapture(SearchMove m)
+{
+    return m.kind == capture_move || m.kind == en_passant_capture;
+}
+
+// TT move first, then captures by most valuable victim and least valuable
+// attacker, promotions, killers and quiet moves by history
+static int orderScore(const Searcher *s, SearchMove m, SearchMove tt_move, int ply)
+{
+    if (sameMove(m, tt_move))
+        return 1 << 30;
+    if (isCapture(m)) {
+        enum PieceType victim = (m.kind == en_passant_capture) ? pawn : CODE_TYPE(s->pos.squares[m.to]);
+        enum PieceType attacker = CODE_TYPE(s->pos.squares[m.from]);
+        return (1 << 24) + piece_values[victim] * 16 - piece_values[attacker] / 10 +
+               ((m.promotion == queen) ? piece_values[queen] : 0);
+    }
+    if (m.promotion == queen)
+        return 1 << 23;
+    if (sameMove(m, s->killers[ply][0]))
+        return (1 << 22) + 1;
+    if (sameMove(m, s->killers[ply][1]))
+        return 1 << 22;
+    return s->history[s->pos.turn][m.from][m.to];
+}
+
+// Brings the best ordered of moves[i..count) to i
+static void pickMove(SearchMove *moves, int *scores, int i, int count)
+{
+    int best = i;
+    for (int k = i + 1; k < count; k++)
+        if (scores[k] > scores[best])
+            best = k;
+    SearchMove m = moves[i];
+    int score = scores[i];
+    moves[i] = moves[best];
+    scores[i] = scores[best];
+    moves[best] = m;
+    scores[best] = score;
+}
+
+// Only captures and promotions to queen, until the side to move would
+// rather stand
+static int quiesce(Searcher *s, int alpha, int beta, int ply)
+{
+    Position *p = &s->pos;
+    if (++s->nodes % CHECK_INTERVAL == 0)
+        checkLimits(s);
+    if (s->stopped)
+        return 0;
+
+    int best = evaluate(p);
+    if (best >= beta || ply >= MAX_PLY - 1)
+        return best;
+    if (best > alpha)
+        alpha = best;
+
+    SearchMove moves[256];
+    int scores[256];
+    int count = generateCaptures(p, moves);
+    for (int i = 0; i < count; i++)
+        scores[i] = orderScore(s, moves[i], no_move, ply);
+
+    for (int i = 0; i < count; i++) {
+        pickMove(moves, scores, i, count);
+        SearchMove m = moves[i];
+        if (m.promotion != no_type && m.promotion != queen)
+            continue;
+
+        PositionUndo u;
+        if (!makePositionMove(p, m, &u))
+            continue;
+        int score = -quiesce(s, -beta, -alpha, ply + 1);
+        unmakePositionMove(p, m, &u);
+        if (s->stopped)
+            return 0;
+
+        if (score > best) {
+            best = score;
+            if (score > alpha)
+                alpha = score;
+            if (alpha >= beta)
+                break;
+        }
+    }
+    return best;
+}
+
+static void rememberCutoff(Searcher *s, SearchMove m, int depth, int ply)
+{
+    if (isCapture(m) || m.promotion != no_type)
+        return;
+    if (!sameMove(m, s->killers[ply][0])) {
+        s->killers[ply][1] = s->killers[ply][0];
+        s->killers[ply][0] = m;
+    }
+    int *h = &s->history[s->pos.turn][m.from][m.to];
+    *h += depth * depth;
+    if (*h > (1 << 20))
+        *h = 1 << 20;
+}
+
+static int alphaBeta(Searcher *s, int alpha, int beta, int depth, int ply)
+{
+    Position *p = &s->pos;
+    s->pv_length[ply] = 0;
+
+    if (ply > 0 && (p->halfmove_clock >= 100 || isRepetition(p) || insufficientMaterial(p->material)))
+        return 0;
+    if (ply >= MAX_PLY - 1)
+        return evaluate(p);
+
+    // Checks are searched one ply deeper, never left to quiescence
+    bool checked = inCheck(p);
+    if (checked)
+        depth++;
+    if (depth <= 0)
+        return quiesce(s, alpha, beta, ply);
+
+    if (++s->nodes % CHECK_INTERVAL == 0)
+        checkLimits(s);
+    if (s->stopped)
+        return 0;
+
+    SearchMove tt_move = no_move;
+    TableData e;
+    if (probeEntry(s->table, p->key, &e)) {
+        tt_move = e.move;
+        int score = scoreFromTable(e.score, ply);
+        if (ply > 0 && e.depth >= depth &&
+            (e.bound == exact_bound ||
+             (e.bound == lower_bound && score >= beta) ||
+             (e.bound == upper_bound && score <= alpha)))
+            return score;
+    }
+
+    SearchMove moves[256];
+    int scores[256];
+    int count = generateMoves(p, moves);
+    for (int i = 0; i < count; i++)
+        scores[i] = orderScore(s, moves[i], tt_move, ply);
+
+    int alpha_before = alpha;
+    int best = -INFINITE_SCORE;
+    SearchMove best_move = no_move;
+    int legal = 0;
+    for (int i = 0; i < count; i++) {
+        pickMove(moves, scores, i, count);
+        SearchMove m = moves[i];
+        if (ply == 0 && isExcluded(s, m))
+            continue;
+        PositionUndo u;
+        if (!makePositionMove(p, m, &u))
+            continue;
+        legal++;
+
+        // Later moves only have to prove they are no better, searched
+        // again in full if they are
+        int score;
+        if (legal == 1) {
+            score = -alphaBeta(s, -beta, -alpha, depth - 1, ply + 1);
+        }
+        else {
+            score = -alphaBeta(s, -alpha - 1, -alpha, depth - 1, ply + 1);
+            if (score > alpha && score < beta)
+                score = -alphaBeta(s, -beta, -alpha, depth - 1, ply + 1);
+        }
+        unmakePositionMove(p, m, &u);
+        if (s->stopped)
+            return 0;
+
+        if (score <= best)
+            continue;
+        best = score;
+        best_move = m;
+        if (score <= alpha)
+            continue;
+
+        alpha = score;
+        s->pv[ply][0] = m;
+        memcpy(&s->pv[ply][1], s->pv[ply + 1], sizeof(SearchMove) * s->pv_length[ply + 1]);
+        s->pv_length[ply] = s->pv_length[ply + 1] + 1;
+        if (alpha >= beta) {
+            rememberCutoff(s, m, depth, ply);
+            break;
+        }
+    }
+
+    if (legal == 0)
+        return checked ? -MATE_SCORE + ply : 0;
+
+    // The root without its best moves would store a worse one as best
+    if (ply > 0 || s->excluded_count == 0) {
+        enum Bound bound = (best >= beta) ? lower_bound : (best > alpha_before) ? exact_bound : upper_bound;
+        storeEntry(s->table, p->key, best_move, best, depth, bound, ply);
+    }
+    return best;
+}
+
+// Root moves the search scores, up to limits.multi_pv of the legal ones.
+// Helpers only ever look for the best one
+static int lineCount(Searcher *s)
+{
+    if (s->id != 0 || s->limits.multi_pv <= 1)
+        return 1;
+    SearchMove legal[256];
+    int count = generateLegalMoves(&s->pos, legal);
+    int lines = (s->limits.multi_pv < MAX_MULTI_PV) ? s->limits.multi_pv : MAX_MULTI_PV;
+    return (count < lines) ? count : lines;
+}
+
+// Orders candidates by score, a later line may score above an earlier one
+static void sortCandidates(SearchCandidate *candidates, int count)
+{
+    for (int i = 1; i < count; i++) {
+        SearchCandidate c = candidates[i];
+        int k = i;
+        for (; k > 0 && candidates[k - 1].score < c.score; k--)
+            candidates[k] = candidates[k - 1];
+        candidates[k] = c;
+    }
+}
+
+// Searches the root deeper and deeper until stopped. Helpers start every
+// other one a ply deeper, so threads spread over depths and fill the
+// table for each other. With multi_pv each depth searches the root again
+// without the moves found so far, for the next best
+static void deepen(Searcher *s)
+{
+    int max_depth = (s->limits.depth > 0 && s->limits.depth < MAX_PLY) ? s->limits.depth : MAX_PLY - 1;
+    int lines = lineCount(s);
+    for (int depth = 1 + (s->id % 2); depth <= max_depth; depth++) {
+        SearchCandidate candidates[MAX_MULTI_PV];
+        SearchMove pv[MAX_PLY];
+        int pv_length = 0;
+        int score = 0;
+
+        s->excluded_count = 0;
+        for (int line = 0; line < lines; line++) {
+            int line_score = alphaBeta(s, -INFINITE_SCORE, INFINITE_SCORE, depth, 0);
+            if (s->stopped || s->pv_length[0] == 0)
+                break;
+            if (line == 0) {
+                score = line_score;
+                pv_length = s->pv_length[0];
+                memcpy(pv, s->pv[0], sizeof(SearchMove) * pv_length);
+            }
+            candidates[line] = (SearchCandidate){s->pv[0][0], line_score};
+            s->excluded[s->excluded_count++] = s->pv[0][0];
+        }
+        int found = s->excluded_count;
+        s->excluded_count = 0;
+        if (s->stopped || pv_length == 0)
+            break;
+        if (s->id != 0)
+            continue;
+
+        s->report.depth = depth;
+        s->report.score = score;
+        s->report.best = pv[0];
+        s->report.pv_length = pv_length;
+        memcpy(s->report.pv, pv, sizeof(SearchMove) * pv_length);
+        sortCandidates(candidates, found);
+        memcpy(s->report.candidates, candidates, sizeof(SearchCandidate) * found);
+        s->report.candidate_count = found;
+        s->report.nodes = atomic_load(&s->shared->nodes) + s->nodes % CHECK_INTERVAL;
+        s->report.seconds = clockSeconds() - s->started;
+        if (s->progress != NULL)
+            s->progress(&s->report, s->arg);
+
+        // A found mate gets no shorter by searching deeper, stop once
+        // every line ends in one
+        bool mates = true;
+        for (int i = 0; i < found; i++)
+            mates = mates && (candidates[i].score > MATE_BOUND || candidates[i].score < -MATE_BOUND);
+        if (mates)
+            break;
+    }
+}
+
+static Searcher *newSearcher(const Position *root, SearchLimits limits, SearchShared *shared, int id)
+{
+    Searcher *s = calloc(1, sizeof(Searcher));
+    assert(s != NULL && "Couldn't allocate searcher");
+    s->pos = *root;
+    s->limits = limits;
+    s->shared = shared;
+    s->table = (limits.table != NULL) ? limits.table : &default_table;
+    s->id = id;
+    s->started = clockSeconds();
+    for (int ply = 0; ply < MAX_PLY; ply++)
+        s->killers[ply][0] = s->killers[ply][1] = no_move;
+    return s;
+}
+
+static void *helperLoop(void *p)
+{
+    Searcher *s = p;
+    deepen(s);
+    atomic_fetch_add(&s->shared->nodes, s->nodes % CHECK_INTERVAL);
+    return NULL;
+}
+
+// Searches root deeper and deeper until a limit is reached, on
+// limits.threads threads sharing the transposition table (Lazy SMP). The
+// report holds the deepest depth the calling thread finished, or any
+// legal move if none finished
+SearchReport searchPosition(const Position *root, SearchLimits limits, SearchProgress progress, void *arg)
+{
+    assert((limits.table != NULL || default_table.entries != NULL) && "initSearch wasn't called");
+
+    SearchShared shared;
+    atomic_init(&shared.stop, false);
+    atomic_init(&shared.nodes, 0);
+
+    Searcher *s = newSearcher(root, limits, &shared, 0);
+    s->progress = progress;
+    s->arg = arg;
+
+    SearchMove legal[256];
+    s->report.best = no_move;
+    if (generateLegalMoves(&s->pos, legal) > 0)
+        s->report.best = legal[0];
+
+    int helper_count = (limits.threads > MAX_SEARCH_THREADS) ? MAX_SEARCH_THREADS - 1 : limits.threads - 1;
+    pthread_t threads[MAX_SEARCH_THREADS];
+    Searcher *helpers[MAX_SEARCH_THREADS];
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, HELPER_STACK_SIZE);
+    int started = 0;
+    for (int i = 0; i < helper_count; i++) {
+        helpers[started] = newSearcher(root, limits, &shared, i + 1);
+        if (pthread_create(&threads[started], &attr, helperLoop, helpers[started]) != 0) {
+            free(helpers[started]);
+            break;
+        }
+        started++;
+    }
+    pthread_attr_destroy(&attr);
+
+    deepen(s);
+    atomic_fetch_add(&shared.nodes, s->nodes % CHECK_INTERVAL);
+    atomic_store(&shared.stop, true);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        free(helpers[i]);
+    }
+
+    s->report.nodes = atomic_load(&shared.nodes);
+    s->report.seconds = clockSeconds() - s->started;
+    SearchReport r = s->report;
+    free(s);
+    return r;
+}
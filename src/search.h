@@ -0,0 +1,65 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdatomic.h>
+
+#include "position.h"
+
+#define MAX_PLY         64
+#define INFINITE_SCORE  32000
+#define MATE_SCORE      31000   // minus plies to the mate
+#define MATE_BOUND      (MATE_SCORE - MAX_PLY)
+
+#define MAX_SEARCH_THREADS 64
+#define DEFAULT_TABLE_MB   64
+#define MAX_MULTI_PV       8
+
+// Transposition table, shared by the threads of a search
+typedef struct {
+    struct TableEntry *entries;
+    uint64_t mask;          // entries - 1, a power of two
+} SearchTable;
+
+typedef struct {
+    int depth;              // stop after this many plies, 0 for no limit
+    int millis;             // stop after this many milliseconds, 0 for no limit
+    long nodes;             // stop after about this many nodes, 0 for no limit
+    int threads;            // threads searching together, 0 or 1 for one
+    int multi_pv;           // best root moves to score, 0 or 1 for one
+    atomic_bool *stop;      // set from another thread to stop early
+    SearchTable *table;     // NULL for the default one, see setTableSize
+} SearchLimits;
+
+typedef struct {
+    SearchMove move;
+    int score;
+} SearchCandidate;
+
+// Progress of a search, the move and score of the deepest finished depth
+typedef struct {
+    int depth;
+    int score;              // centipawns for the side to move, see MATE_SCORE
+    long nodes;
+    double seconds;
+    SearchMove best;
+    SearchMove pv[MAX_PLY];
+    int pv_length;
+    SearchCandidate candidates[MAX_MULTI_PV];   // best first, see multi_pv
+    int candidate_count;
+} SearchReport;
+
+// Called after each finished depth and now and then in between
+typedef void (*SearchProgress)(const SearchReport *r, void *arg);
+
+void initSearch(void);
+void setTableSize(int megabytes);
+SearchTable newSearchTable(int megabytes);
+void freeSearchTable(SearchTable *t);
+void clearSearchTable(SearchTable *t);
+void clearSearch(void);
+SearchReport searchPosition(const Position *root, SearchLimits limits, SearchProgress progress, void *arg);
+int evaluate(const Position *p);
+int mateIn(int score);
+long nodesPerSecond(const SearchReport *r);
+
+#endif // SEARCH_H
@@ -0,0 +1,72 @@
+#ifndef SQUARES_H
+#define SQUARES_H
+
+#include "declarations.h"
+
+// Square addressing used by the fillers and recorders when walking the
+// board. Build with -DBOARD_0X88 to use 0x88 numbering instead of the
+// cell grid indices
+
+#ifdef BOARD_0X88
+
+// Rank in the high nibble, file in the low one. Stepping off the board
+// sets bit 3 or bit 7, so one mask test tells whether a square is valid
+typedef int Square;
+
+static inline Square toSquare(V2 idx)
+{
+    return idx.y * 16 + idx.x;
+}
+
+static inline Square stepSquare(Square s, int dx, int dy)
+{
+    return s + dy * 16 + dx;
+}
+
+static inline bool onBoard(Square s)
+{
+    return !(s & 0x88);
+}
+
+static inline Cell *cellAt(Board *b, Square s)
+{
+    return &(b->cells[s >> 4][s & 7]);
+}
+
+static inline Mask squareBit(Square s)
+{
+    return (Mask)1 << ((s >> 4) * 8 + (s & 7));
+}
+
+#else
+
+typedef V2 Square;
+
+static inline Square toSquare(V2 idx)
+{
+    return idx;
+}
+
+static inline Square stepSquare(Square s, int dx, int dy)
+{
+    return (V2){.x = s.x + dx, .y = s.y + dy};
+}
+
+static inline bool onBoard(Square s)
+{
+    return (0 <= s.x && s.x < 8) && (0 <= s.y && s.y < 8);
+}
+
+static inline Cell *cellAt(Board *b, Square s)
+{
+    return &(b->cells[s.y][s.x]);
+}
+
+static inline Mask squareBit(Square s)
+{
+    return (Mask)1 << (s.y * 8 + s.x);
+}
+
+#endif // BOARD_0X88
+
+#endif // SQUARES_H
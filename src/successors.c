@@ -0,0 +1,170 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "successors.h"
+#include "masks.h"
+#include "tools.h"
+#include "zobrist.h"
+
+#define MAX_THREADS     4
+#define MAX_SUCCESSORS  256     // more than legal moves of any position
+
+// Successors only make moves, which keep their boards on the heap
+#define SUCCESSOR_STACK_SIZE (64 * 1024)
+
+typedef struct {
+    int from;
+    int to;
+    bool ready;
+} Successor;
+
+static pthread_t threads[MAX_THREADS];
+static int thread_count = 0;
+static bool stopping = false;
+
+// Position being speculated on and its moves, guarded by lock. Each new
+// position bumps generation, so moves made for an older one are dropped
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static Board *base = NULL;
+static uint64_t base_key;
+static unsigned int generation = 0;
+static Successor moves[MAX_SUCCESSORS];
+static Board *boards = NULL;        // by move
+static int move_count = 0;
+static int next_move = 0;
+
+static void *successorLoop(void *p)
+{
+    Board *tmp = p;
+
+    pthread_mutex_lock(&lock);
+    while (!stopping) {
+        if (next_move >= move_count) {
+            pthread_cond_wait(&work_ready, &lock);
+            continue;
+        }
+        int i = next_move++;
+        unsigned int started = generation;
+        copyBoard(tmp, base);
+        Move m = {
+            .src = &(tmp->cells[SQ_Y(moves[i].from)][SQ_X(moves[i].from)]),
+            .dst = &(tmp->cells[SQ_Y(moves[i].to)][SQ_X(moves[i].to)]),
+        };
+        pthread_mutex_unlock(&lock);
+
+        makeMove(m, tmp);
+
+        // Promotions wait for the chosen piece, so they are left to the player
+        pthread_mutex_lock(&lock);
+        if (generation == started && !tmp->promotion_pending) {
+            copyBoard(&boards[i], tmp);
+            moves[i].ready = true;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    free(tmp);
+    return NULL;
+}
+
+// Starts count background threads, they idle until speculateSuccessors
+void startSuccessors(int count)
+{
+    if (thread_count > 0)
+        return;
+    if (count > MAX_THREADS)
+        count = MAX_THREADS;
+
+    base = malloc(sizeof(Board));
+    boards = malloc(sizeof(Board) * MAX_SUCCESSORS);
+    if (base == NULL || boards == NULL)
+        assert(0 && "Couldn't allocate successor boards");
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SUCCESSOR_STACK_SIZE);
+
+    stopping = false;
+    for (int i = 0; i < count; i++) {
+        Board *tmp = malloc(sizeof(Board));
+        if (tmp == NULL || pthread_create(&threads[i], &attr, successorLoop, tmp) != 0) {
+            free(tmp);
+            break;
+        }
+        thread_count++;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void stopSuccessors(void)
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < thread_count; i++)
+        pthread_join(threads[i], NULL);
+    thread_count = 0;
+
+    free(base);
+    free(boards);
+    base = NULL;
+    boards = NULL;
+    move_count = 0;
+    next_move = 0;
+}
+
+// Drops successors of the previous position and starts on those of b,
+// should be called whenever the position on screen changes
+void speculateSuccessors(const Board *b)
+{
+    if (thread_count == 0)
+        return;
+
+    pthread_mutex_lock(&lock);
+    generation++;
+    move_count = 0;
+    next_move = 0;
+
+    if (!gameOver(b) && !b->promotion_pending) {
+        copyBoard(base, b);
+        base_key = positionKey(b);
+        Mask pieces = b->occupied[b->turn];
+        while (pieces) {
+            int from = popLsb(&pieces);
+            Mask targets = b->legal_moves[from];
+            while (targets)
+                moves[move_count++] = (Successor){.from = from, .to = popLsb(&targets)};
+        }
+        pthread_cond_broadcast(&work_ready);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// Copies the board after move m into out, if its successor is ready. out
+// may be b itself
+bool takeSuccessor(const Board *b, Move m, Board *out)
+{
+    if (thread_count == 0)
+        return false;
+
+    int from = cellSq(m.src);
+    int to = cellSq(m.dst);
+    bool taken = false;
+
+    pthread_mutex_lock(&lock);
+    if (move_count > 0 && b->move_count == base->move_count && positionKey(b) == base_key) {
+        for (int i = 0; i < move_count; i++) {
+            if (moves[i].from == from && moves[i].to == to && moves[i].ready) {
+                copyBoard(out, &boards[i]);
+                taken = true;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return taken;
+}
@@ -0,0 +1,14 @@
+#ifndef SUCCESSORS_H
+#define SUCCESSORS_H
+
+#include "declarations.h"
+
+// Boards after each legal move of the position on screen, computed on
+// background threads while the player thinks about the next move
+
+void startSuccessors(int count);
+void stopSuccessors(void);
+void speculateSuccessors(const Board *b);
+bool takeSuccessor(const Board *b, Move m, Board *out);
+
+#endif // SUCCESSORS_H
@@ -3,11 +3,97 @@
 #include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "tools.h"
 #include "recorders.h"
-#include "colorizers.h"
 #include "fillers.h"
+#include "masks.h"
+#include "material.h"
+#include "zobrist.h"
+
+// Castling of standard chess, known at compile time so the common case
+// doesn't depend on per board data
+static const CastlingRule standard_castling_rules[2][2] = {
+    [black] = {
+        [queenside] = {.king_from = 4, .king_to = 2, .rook_from = 0, .rook_to = 3,
+                       .path = 0x0eULL, .safe = 0x0cULL},
+        [kingside] = {.king_from = 4, .king_to = 6, .rook_from = 7, .rook_to = 5,
+                      .path = 0x60ULL, .safe = 0x60ULL},
+    },
+    [white] = {
+        [queenside] = {.king_from = 60, .king_to = 58, .rook_from = 56, .rook_to = 59,
+                       .path = 0x0e00000000000000ULL, .safe = 0x0c00000000000000ULL},
+        [kingside] = {.king_from = 60, .king_to = 62, .rook_from = 63, .rook_to = 61,
+                      .path = 0x6000000000000000ULL, .safe = 0x6000000000000000ULL},
+    },
+};
+
+// Gives castling right to a king and rook, switching the board to chess960
+// if they aren't on their standard cells
+static void setCastlingRule(Board *b, enum PieceColor color, enum CastlingSide side, int king_sq, int rook_sq)
+{
+    int y = SQ_Y(king_sq);
+    int king_to = SQ((side == queenside) ? 2 : 6, y);
+    int rook_to = SQ((side == queenside) ? 3 : 5, y);
+    Mask ends = BIT(king_sq) | BIT(rook_sq);
+    CastlingRule rule = {
+        .king_from = king_sq,
+        .king_to = king_to,
+        .rook_from = rook_sq,
+        .rook_to = rook_to,
+        .path = (lineBetween(king_sq, king_to) | BIT(king_to) |
+                 lineBetween(rook_sq, rook_to) | BIT(rook_to)) & ~ends,
+        // The king's own cell counts when it doesn't move, as the rook
+        // leaving can open a line onto it
+        .safe = (lineBetween(king_sq, king_to) & ~BIT(king_sq)) | BIT(king_to),
+    };
+
+    const CastlingRule *standard = &standard_castling_rules[color][side];
+    if (king_sq != standard->king_from || rook_sq != standard->rook_from)
+        b->chess960 = true;
+    b->castling_rules[color][side] = rule;
+    b->castling_rights |= CASTLE_RIGHT(color, side);
+
+    // Moving the king loses both rights, moving or capturing the rook one
+    b->castling_rights_kept[king_sq] &= ~(CASTLE_RIGHT(color, queenside) | CASTLE_RIGHT(color, kingside));
+    b->castling_rights_kept[rook_sq] &= ~CASTLE_RIGHT(color, side);
+}
+
+const CastlingRule *castlingRule(const Board *b, enum PieceColor color, enum CastlingSide side)
+{
+    if (!b->chess960)
+        return &standard_castling_rules[color][side];
+    return &b->castling_rules[color][side];
+}
+
+// Cell the king is moved to for castling: its destination in standard chess,
+// the rook itself in chess960 (as the destination might be a normal king move)
+int castlingTarget(const Board *b, enum PieceColor color, enum CastlingSide side)
+{
+    const CastlingRule *rule = castlingRule(b, color, side);
+    return b->chess960 ? rule->rook_from : rule->king_to;
+}
+
+// Side castled on if a king moving from -> to castles, -1 otherwise
+int castlingSide(const Board *b, enum PieceColor color, int from, int to)
+{
+    for (int side = queenside; side <= kingside; side++) {
+        if ((b->castling_rights & CASTLE_RIGHT(color, side)) &&
+            from == castlingRule(b, color, side)->king_from &&
+            to == castlingTarget(b, color, side))
+            return side;
+    }
+    return -1;
+}
 
 Board initBoard(void)
 {
@@ -16,10 +102,65 @@ Board initBoard(void)
     return b;
 }
 
+// Chess960 start position by its Scharnagl number (0-959), 518 is standard
+Board initBoard960(int id)
+{
+    char rank[9] = "        ";
+    int n = id % 960;
+
+    rank[2 * (n % 4) + 1] = 'b';    // light squared bishop
+    n /= 4;
+    rank[2 * (n % 4)] = 'b';        // dark squared bishop
+    n /= 4;
+
+    // Remaining pieces fill the nth empty cell
+    char order[6];
+    int knights[10][2] = {{0, 1}, {0, 2}, {0, 3}, {0, 4}, {1, 2}, {1, 3}, {1, 4}, {2, 3}, {2, 4}, {3, 4}};
+    int queen_at = n % 6;
+    n /= 6;
+    for (int k = 0; k < 5; k++)
+        order[k] = (k == knights[n][0] || k == knights[n][1]) ? 'n' : ' ';
+    char *rest = "rkr";
+    for (int k = 0, r = 0; k < 5; k++)
+        if (order[k] == ' ')
+            order[k] = rest[r++];
+
+    for (int x = 0, empty = 0, k = 0; x < 8; x++) {
+        if (rank[x] != ' ')
+            continue;
+        if (empty++ == queen_at)
+            rank[x] = 'q';
+        else
+            rank[x] = order[k++];
+    }
+
+    // Rights named by rook files, outer rook first
+    char rights[5];
+    int r = 0;
+    for (int x = 7; x >= 0; x--)
+        if (rank[x] == 'r')
+            rights[r++] = 'A' + x;
+    rights[r++] = tolower(rights[0]);
+    rights[r++] = tolower(rights[1]);
+    rights[r] = '\0';
+
+    char upper[9];
+    for (int x = 0; x < 9; x++)
+        upper[x] = toupper(rank[x]);
+
+    char fen[100];
+    sprintf(fen, "%s/pppppppp/8/8/8/8/PPPPPPPP/%s w %s - 0 1", rank, upper, rights);
+    return initBoardFromFEN(fen);
+}
+
 Board initBoardFromFEN(char *fen)
 {
     Board b;
 
+    initMasks();
+    initZobrist();
+    initMaterial();
+
     b.turn = white;
     b.move_count = 0;
     b.halfmove_clock = 0;
@@ -30,37 +171,59 @@ Board initBoardFromFEN(char *fen)
     b.checkmate = false;
     b.draw_by_fifty_move = false;
     b.draw_by_stalemate = false;
+    b.draw_by_repetition = false;
+    b.draw_by_insufficient_material = false;
+    b.last_move_captured = false;
     b.king_checked = false;
+#ifdef VERIFY_LEGAL_MOVES
     b.filter_nonblocking_cells = true;
     b.filter_check_opening = true;
+#endif
     b.has_en_passant_target = false;
     b.checked_king = NULL;
     b.active_cell = NULL;
     b.promoting_cell = NULL;
-    b.queenside_castling_cell[black] = NULL;
-    b.queenside_castling_cell[white] = NULL;
-    b.kingside_castling_cell[black] = NULL;
-    b.kingside_castling_cell[white] = NULL;
+    b.chess960 = false;
+
+    // Positions before the FEN's are unknown, no key matches these
+    for (int i = 0; i < KEY_HISTORY_SIZE; i++)
+        b.key_history[i] = 0;
+
+    b.castling_rights = 0;
+    b.in_range = 0;
+    for (int c = 0; c < 2; c++) {
+        b.occupied[c] = 0;
+        for (int t = 0; t < 6; t++)
+            b.pieces[c][t] = 0;
+        b.moves_changed[c] = 0;
+        b.moves_checkers[c] = 0;
+        b.moves_pinned[c] = 0;
+        b.moves_king_sq[c] = -1;    // records all legal moves the first time
+    }
+    for (int sq = 0; sq < 64; sq++)
+        b.castling_rights_kept[sq] = ALL_CASTLE_RIGHTS;
+    for (int c = 0; c < 2; c++) {
+        for (int side = 0; side < 2; side++) {
+            b.castling_cells[c][side] = NULL;
+            b.castling_rules[c][side] = standard_castling_rules[c][side];
+        }
+    }
 
     Piece empty_piece = {.type = no_type, .color = no_color};
     for (int y = 0; y < 8; y++) {
         for (int x = 0; x < 8; x++) {
             b.cells[y][x].piece = empty_piece;
-            b.cells[y][x].pos = cellPosByIdx(x, y);
             b.cells[y][x].idx.y = y;
             b.cells[y][x].idx.x = x;
-            b.cells[y][x].in_range = false;
-            b.cells[y][x].is_movable = false;
             b.cells[y][x].is_dangerous[black] = false;
             b.cells[y][x].is_dangerous[white] = false;
+#ifdef VERIFY_LEGAL_MOVES
+            b.cells[y][x].is_movable = false;
             b.cells[y][x].blocks_check = false;
             b.cells[y][x].opens_check = false;
-            for (int i = 0; i < 8; i++) {
-                for (int j = 0; j < 8; j++) {
-                    b.cells[y][x].check_blocking_cells[i][j] = false;
-                    b.cells[y][x].check_opening_cells[i][j] = false;
-                }
-            }
+            b.cells[y][x].check_blocking_cells = 0;
+            b.cells[y][x].check_opening_cells = 0;
+#endif
         }
     }
 
@@ -99,29 +262,47 @@ Board initBoardFromFEN(char *fen)
     b.turn = fen[i] == 'w' ? white : black;
     i += 2;
 
-    // Set castling information
-    b.queenside_castle_available[black] = false;
-    b.queenside_castle_available[white] = false;
-    b.kingside_castle_available[black] = false;
-    b.kingside_castle_available[white] = false;
+    // Set castling information, either KQkq or the rook files (chess960)
     while (fen[i] != ' ') {
-        switch (fen[i]) {
-        case 'K':
-            b.kingside_castle_available[white] = true;
-            break;
-        case 'Q':
-            b.queenside_castle_available[white] = true;
-            break;
-        case 'k':
-            b.kingside_castle_available[black] = true;
-            break;
-        case 'q':
-            b.queenside_castle_available[black] = true;
-            break;
-        default:
-            break;
+        char c = fen[i++];
+        if (c == '-')
+            continue;
+
+        enum PieceColor color = isupper(c) ? white : black;
+        int y = (color == white) ? 7 : 0;
+        int king_x = -1;
+        for (int x = 0; x < 8; x++) {
+            Piece p = b.cells[y][x].piece;
+            if (p.type == king && p.color == color)
+                king_x = x;
         }
-        i++;
+        if (king_x == -1)
+            continue;
+
+        // K and Q stand for the outermost rook on that side
+        int rook_x = -1;
+        char upper = toupper(c);
+        if (upper == 'K' || upper == 'Q') {
+            int step = (upper == 'K') ? -1 : 1;
+            for (int x = (upper == 'K') ? 7 : 0; x != king_x; x += step) {
+                Piece p = b.cells[y][x].piece;
+                if (p.type == rook && p.color == color) {
+                    rook_x = x;
+                    break;
+                }
+            }
+        }
+        else if ('A' <= upper && upper <= 'H') {
+            rook_x = upper - 'A';
+        }
+        if (rook_x == -1 || rook_x == king_x)
+            continue;
+        Piece r = b.cells[y][rook_x].piece;
+        if (r.type != rook || r.color != color)
+            continue;
+
+        enum CastlingSide side = (rook_x < king_x) ? queenside : kingside;
+        setCastlingRule(&b, color, side, SQ(king_x, y), SQ(rook_x, y));
     }
     i++;
 
@@ -150,13 +331,120 @@ Board initBoardFromFEN(char *fen)
         b.fullmoves = b.fullmoves * 10 + (fen[i] - '0');
     }
 
-    resetCellBackgrounds(&b);
+    b.material = materialSignature(&b);
     recordStateChangesAfterMove(&b);
-    colorKingIfChecked(&b);
     return b;
 }
 
-void generateFEN(Board b)
+// Reads the placement field of a FEN into cells, a piece letter or ' ' per
+// cell. It has to be 8 ranks of 8 cells of known pieces, with one king a
+// side and no pawns on the first or last rank
+static bool readPlacement(const char *placement, int length, char cells[64])
+{
+    int kings[2] = {0, 0};
+    int x = 0, y = 0;
+    for (int i = 0; i < length; i++) {
+        char c = placement[i];
+        if (c == '/') {
+            if (x != 8 || ++y > 7)
+                return false;
+            x = 0;
+            continue;
+        }
+        if ('1' <= c && c <= '8') {
+            if (x + c - '0' > 8)
+                return false;
+            for (int n = c - '0'; n > 0; n--)
+                cells[SQ(x++, y)] = ' ';
+            continue;
+        }
+        if (c == '\0' || strchr("KQRBNPkqrbnp", c) == NULL || x > 7)
+            return false;
+        if (toupper(c) == 'P' && (y == 0 || y == 7))
+            return false;
+        if (toupper(c) == 'K')
+            kings[isupper(c) ? white : black]++;
+        cells[SQ(x++, y)] = c;
+    }
+    return x == 8 && y == 7 && kings[black] == 1 && kings[white] == 1;
+}
+
+// Copies the fields of a FEN or EPD line into fen, one space apart, with
+// the move counters initBoardFromFEN wants when an EPD leaves them out in
+// favour of its operations. False when the line isn't a position
+// initBoardFromFEN can take, which would leave the board half set up
+bool normalizeFEN(const char *line, char *fen, int size)
+{
+    const char *separators = " \t\r\n";
+    const char *fields[6] = {NULL, NULL, NULL, NULL, "0", "1"};
+    int lengths[6] = {0, 0, 0, 0, 1, 1};
+    int count = 0;
+    const char *c = line + strspn(line, separators);
+    while (*c != '\0' && count < 6) {
+        int length = strcspn(c, separators);
+        bool counter = length <= 6 && (int)strspn(c, "0123456789") >= length;
+        if (count >= 4 && !counter)
+            break;
+        fields[count] = c;
+        lengths[count++] = length;
+        c += length;
+        c += strspn(c, separators);
+    }
+    if (count < 4)
+        return false;
+
+    char cells[64];
+    if (!readPlacement(fields[0], lengths[0], cells))
+        return false;
+    if (lengths[1] != 1 || (fields[1][0] != 'w' && fields[1][0] != 'b'))
+        return false;
+    bool no_castling = lengths[2] == 1 && fields[2][0] == '-';
+    if (!no_castling && (lengths[2] > 4 || (int)strspn(fields[2], "KQkqABCDEFGHabcdefgh") < lengths[2]))
+        return false;
+
+    // An en passant target lies behind a pawn of the side not to move that
+    // has just been pushed two cells
+    if (lengths[3] != 1 || fields[3][0] != '-') {
+        const char *target = fields[3];
+        bool white_to_move = fields[1][0] == 'w';
+        if (lengths[3] != 2 || target[0] < 'a' || target[0] > 'h' || target[1] != (white_to_move ? '6' : '3'))
+            return false;
+        int x = target[0] - 'a';
+        int y = '8' - target[1];
+        int forward = white_to_move ? 1 : -1;
+        if (cells[SQ(x, y)] != ' ' || cells[SQ(x, y - forward)] != ' ' ||
+            cells[SQ(x, y + forward)] != (white_to_move ? 'p' : 'P'))
+            return false;
+    }
+
+    int written = snprintf(fen, size, "%.*s %.*s %.*s %.*s %.*s %.*s", lengths[0], fields[0], lengths[1],
+                           fields[1], lengths[2], fields[2], lengths[3], fields[3], lengths[4], fields[4],
+                           lengths[5], fields[5]);
+    return written > 0 && written < size;
+}
+
+// Seconds on a monotonic clock, for timing searches
+double clockSeconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// One thread per extra core, the calling thread takes work too
+int suggestedWorkerCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int cores = info.dwNumberOfProcessors;
+#else
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return (cores > 1) ? cores - 1 : 0;
+}
+
+void generateFEN(const Board *b)
 {
     // Piece placing
     int i = 0;
@@ -164,9 +452,9 @@ void generateFEN(Board b)
     char notation[] = {'k', 'q', 'b', 'n', 'r', 'p'};
     int x = 0, y = 0;
     while (true) {
-        if (emptyCell(b.cells[y][x]))  {
+        if (emptyCell(&b->cells[y][x]))  {
             int count = 0;
-            while (emptyCell(b.cells[y][x])) {
+            while (emptyCell(&b->cells[y][x])) {
                 count++;
                 x++;
                 if (x == 8) {
@@ -183,7 +471,7 @@ void generateFEN(Board b)
                 break;
         }
 
-        Piece p = b.cells[y][x].piece;
+        Piece p = b->cells[y][x].piece;
         char nt = notation[p.type];
         if (p.color == white)
             nt = toupper(nt);
@@ -205,19 +493,23 @@ void generateFEN(Board b)
         piece_info[i - 1] = '\0';
 
     // Turn
-    char turn = b.turn == white ? 'w' : 'b';
+    char turn = b->turn == white ? 'w' : 'b';
 
-    // Castling info
+    // Castling info, chess960 boards name the rook files
     i = 0;
     char castling_info[5];
-    if (b.kingside_castle_available[white])
-        castling_info[i++] = 'K';
-    if (b.queenside_castle_available[white])
-        castling_info[i++] = 'Q';
-    if (b.kingside_castle_available[black])
-        castling_info[i++] = 'k';
-    if (b.queenside_castle_available[black])
-        castling_info[i++] = 'q';
+    enum PieceColor order[2] = {white, black};
+    for (int k = 0; k < 2; k++) {
+        enum PieceColor c = order[k];
+        for (int side = kingside; side >= queenside; side--) {
+            if (!(b->castling_rights & CASTLE_RIGHT(c, side)))
+                continue;
+            char letter = (side == kingside) ? 'k' : 'q';
+            if (b->chess960)
+                letter = 'a' + SQ_X(b->castling_rules[c][side].rook_from);
+            castling_info[i++] = (c == white) ? toupper(letter) : letter;
+        }
+    }
     if (i == 0)
         castling_info[i++] = '-';
     castling_info[i] = '\0';
@@ -225,9 +517,9 @@ void generateFEN(Board b)
     // En passant target square
     i = 0;
     char en_passant_target[3];
-    if (b.has_en_passant_target) {
-        char file = 'a' + b.en_passant_target_idx.x;
-        char rank = '0' + (8 - b.en_passant_target_idx.y);
+    if (b->has_en_passant_target) {
+        char file = 'a' + b->en_passant_target_idx.x;
+        char rank = '0' + (8 - b->en_passant_target_idx.y);
         en_passant_target[i++] = file;
         en_passant_target[i++] = rank;
     } else {
@@ -236,36 +528,10 @@ void generateFEN(Board b)
     en_passant_target[i++] = '\0';
 
     char fen[100];
-    sprintf(fen, "%s %c %s %s %d %d", piece_info, turn, castling_info, en_passant_target, b.halfmove_clock, b.fullmoves);
+    sprintf(fen, "%s %c %s %s %d %d", piece_info, turn, castling_info, en_passant_target, b->halfmove_clock, b->fullmoves);
     printf("FEN: %s\n", fen);
 }
 
-PromotionWindow initPromotionWindow(void)
-{
-    PromotionWindow pwin;
-    pwin.promotables[0] = queen;
-    pwin.promotables[1] = rook;
-    pwin.promotables[2] = knight;
-    pwin.promotables[3] = bishop;
-
-    pwin.padding = 10;
-    pwin.cell_margin = 5;
-
-    pwin.text = "Promote To";
-    pwin.text_height = 30;
-    pwin.text_width = MeasureText(pwin.text, pwin.text_height);
-
-    pwin.height = CELL_SIZE + pwin.padding * 3 + pwin.text_height;
-    pwin.width = CELL_SIZE * 4 + pwin.cell_margin * 3 + pwin.padding * 2;
-
-    pwin.pos.x = BOARD_SIZE / 2 - pwin.width / 2;
-    pwin.pos.y = BOARD_SIZE / 2 - pwin.height / 2;
-    pwin.first_cell_pos.x = pwin.pos.x + pwin.padding;
-    pwin.first_cell_pos.y = pwin.pos.y + pwin.padding * 2 + pwin.text_height;
-
-    return pwin;
-}
-
 // Returns the drawing position
 V2 cellPosByIdx(int x, int y)
 {
@@ -288,9 +554,29 @@ bool validCellIdx(int x, int y)
     return (0 <= x && x < 8) && (0 <= y && y < 8);
 }
 
-bool emptyCell(Cell c)
+bool emptyCell(const Cell *c)
+{
+    return c->piece.type == no_type && c->piece.color == no_color;
+}
+
+// Cell of dst at the same place as c
+static Cell *rebaseCell(const Cell *c, Board *dst)
+{
+    return (c != NULL) ? &(dst->cells[c->idx.y][c->idx.x]) : NULL;
+}
+
+// Copies src into dst, with its cell pointers pointing at cells of dst
+void copyBoard(Board *dst, const Board *src)
 {
-    return c.piece.type == no_type && c.piece.color == no_color;
+    *dst = *src;
+    dst->active_cell = rebaseCell(src->active_cell, dst);
+    dst->checked_king = rebaseCell(src->checked_king, dst);
+    dst->promoting_cell = rebaseCell(src->promoting_cell, dst);
+    dst->last_move.src = rebaseCell(src->last_move.src, dst);
+    dst->last_move.dst = rebaseCell(src->last_move.dst, dst);
+    for (int c = 0; c < 2; c++)
+        for (int side = 0; side < 2; side++)
+            dst->castling_cells[c][side] = rebaseCell(src->castling_cells[c][side], dst);
 }
 
 void movePiece(Cell *from, Cell *to)
@@ -303,80 +589,340 @@ void movePiece(Cell *from, Cell *to)
     from->piece = empty_piece;
 }
 
+// Kinds of moves needing more than moving one piece
+enum MoveFlag {
+    normal_move,
+    double_push_move,
+    en_passant_move,
+    castling_move,
+    promotion_move,
+};
+
+typedef void (*MoveHandler)(const Move m, Board *b);
+
+static enum MoveFlag moveFlag(const Board *b, const Move m)
+{
+    enum PieceType stype = m.src->piece.type;
+    V2 si = m.src->idx;
+    V2 di = m.dst->idx;
+
+    if (stype == king)
+        return castlingSide(b, m.src->piece.color, cellSq(m.src), cellSq(m.dst)) != -1
+               ? castling_move : normal_move;
+    if (stype != pawn)
+        return normal_move;
+    if (di.y == 0 || di.y == 7)
+        return promotion_move;
+    if (di.y - si.y == 2 || si.y - di.y == 2)
+        return double_push_move;
+    if (b->has_en_passant_target && di.x == b->en_passant_target_idx.x && di.y == b->en_passant_target_idx.y)
+        return en_passant_move;
+    return normal_move;
+}
+
+static void makeNormalMove(const Move m, Board *b)
+{
+    (void)b;
+    movePiece(m.src, m.dst);
+}
+
+// Records the cell skipped over as en passant target
+static void makeDoublePush(const Move m, Board *b)
+{
+    movePiece(m.src, m.dst);
+    b->en_passant_target_idx = (V2){.y = (m.src->idx.y + m.dst->idx.y) / 2, .x = m.src->idx.x};
+    b->has_en_passant_target = true;
+}
+
+// Consumes the double pushed pawn, on the source rank in the target file
+static void makeEnPassant(const Move m, Board *b)
+{
+    movePiece(m.src, m.dst);
+    b->cells[m.src->idx.y][m.dst->idx.x].piece = (Piece){.type = no_type, .color = no_color};
+}
+
+// Lifts both pieces first, a chess960 king may land where the rook was
+static void makeCastling(const Move m, Board *b)
+{
+    enum PieceColor color = m.src->piece.color;
+    const CastlingRule *rule = castlingRule(b, color, castlingSide(b, color, cellSq(m.src), cellSq(m.dst)));
+    Cell *king_to = &(b->cells[SQ_Y(rule->king_to)][SQ_X(rule->king_to)]);
+    Cell *rook_from = &(b->cells[SQ_Y(rule->rook_from)][SQ_X(rule->rook_from)]);
+    Cell *rook_to = &(b->cells[SQ_Y(rule->rook_to)][SQ_X(rule->rook_to)]);
+    Piece k = m.src->piece;
+    Piece r = rook_from->piece;
+    m.src->piece = (Piece){.type = no_type, .color = no_color};
+    rook_from->piece = (Piece){.type = no_type, .color = no_color};
+    king_to->piece = k;
+    rook_to->piece = r;
+    b->last_move.dst = king_to;
+}
+
+// Piece to promote to is chosen later, see handlePromotion
+static void makePromotion(const Move m, Board *b)
+{
+    movePiece(m.src, m.dst);
+    b->promotion_pending = true;
+    b->promoting_cell = m.dst;
+}
+
+static const MoveHandler move_handlers[] = {
+    [normal_move] = makeNormalMove,
+    [double_push_move] = makeDoublePush,
+    [en_passant_move] = makeEnPassant,
+    [castling_move] = makeCastling,
+    [promotion_move] = makePromotion,
+};
+
 void makeMove(const Move move, Board *b)
 {
-    enum PieceColor scolor = move.src->piece.color;
-    enum PieceType stype = move.src->piece.type;
-    V2 si = move.src->idx;
-    V2 di = move.dst->idx;
-    bool move_is_capturing = !emptyCell(*move.dst);
+    enum MoveFlag flag = moveFlag(b, move);
+    bool captured = (flag != castling_move && !emptyCell(move.dst)) || flag == en_passant_move;
+    bool resets_clock = captured || move.src->piece.type == pawn;
+
+    // Captured pieces leave the material, so does a promoting pawn until
+    // its piece is chosen
+    if (flag == en_passant_move) {
+        int taken = SQ(move.dst->idx.x, move.src->idx.y);
+        b->material -= materialOf(b->cells[SQ_Y(taken)][SQ_X(taken)].piece, taken);
+    }
+    else if (captured) {
+        b->material -= materialOf(move.dst->piece, cellSq(move.dst));
+    }
+    if (flag == promotion_move)
+        b->material -= materialOf(move.src->piece, cellSq(move.src));
 
-    recordCastlingRightChanges(move, b);
-    movePiece(move.src, move.dst);
     b->last_move = move;
+    b->has_en_passant_target = false;
+    move_handlers[flag](move, b);
 
-    b->move_count++;
-    b->halfmove_clock++;
-    if (b->move_count % 2 == 0)
-        b->fullmoves++;
+    // After the handler, castling finds its rule by the rights held
+    recordCastlingRightChanges(move, b);
 
     // Captures or pawn movements reset halfmove clock
-    if (stype == pawn || move_is_capturing)
-        b->halfmove_clock = 0;
-
-    // Move rook too if castled
-    bool castled =
-        stype == king && (move.dst == b->queenside_castling_cell[scolor] ||
-                          move.dst == b->kingside_castling_cell[scolor]);
-    if (castled) {
-        int rook_dir = (move.dst == b->queenside_castling_cell[scolor]) ? 1 : -1;
-        int rook_x = (move.dst == b->queenside_castling_cell[scolor]) ? 0 : 7;
-        movePiece(&(b->cells[di.y][rook_x]), &(b->cells[di.y][di.x + rook_dir]));
-        b->queenside_castle_available[scolor] = false;
-        b->kingside_castle_available[scolor] = false;
+    b->last_move_captured = captured;
+    b->move_count++;
+    b->fullmoves += b->move_count % 2 == 0;
+    b->halfmove_clock = resets_clock ? 0 : b->halfmove_clock + 1;
+
+    b->move_pending = false;
+    b->active_cell = NULL;
+    changeTurn(b);
+
+    // State is recorded once the promoted piece is chosen
+    if (flag != promotion_move)
+        recordStateChangesAfterMove(b);
+}
+
+// Puts the chosen piece on the cell of a pending promotion and records the
+// state makeMove left for then
+void completePromotion(Board *b, enum PieceType type)
+{
+    Cell *c = b->promoting_cell;
+    c->piece.type = type;
+    b->material += materialOf(c->piece, cellSq(c));
+    b->promotion_pending = false;
+    b->promoting_cell = NULL;
+    recordStateChangesAfterMove(b);
+}
+
+// Finds whether a move by the side to move checks the opponent king, using
+// masks recorded for the position before the move. Promotions are judged as
+// promotions to queen
+bool givesCheck(const Board *b, const Move m)
+{
+    int ksq = b->opponent_king_sq;
+    if (ksq < 0)
+        return false;
+
+    Piece p = m.src->piece;
+    int from = cellSq(m.src);
+    int to = cellSq(m.dst);
+    bool promoting = p.type == pawn && (SQ_Y(to) == 0 || SQ_Y(to) == 7);
+
+    // Moved piece attacks the king from its new cell
+    if (!promoting && (b->check_squares[p.type] & BIT(to)))
+        return true;
+
+    // Moving off the line between a slider and the king
+    if ((b->discovered_checkers & BIT(from)) && !(lineThrough(from, ksq) & BIT(to)))
+        return true;
+
+    // Special moves change more cells than the two above
+    Mask occupied = b->occupied[black] | b->occupied[white];
+    Mask after = (occupied & ~BIT(from)) | BIT(to);
+    Mask orthogonal = b->pieces[p.color][rook] | b->pieces[p.color][queen];
+    Mask diagonal = b->pieces[p.color][bishop] | b->pieces[p.color][queen];
+
+    if (promoting) {
+        Piece promoted = {.type = queen, .color = p.color};
+        return pieceAttacks(promoted, to, after) & BIT(ksq);
+    }
+
+    int side = (p.type == king) ? castlingSide(b, p.color, from, to) : -1;
+    if (side != -1) {
+        const CastlingRule *rule = castlingRule(b, p.color, side);
+        after = (occupied & ~BIT(from) & ~BIT(rule->rook_from)) | BIT(rule->king_to) | BIT(rule->rook_to);
+        orthogonal = (orthogonal & ~BIT(rule->rook_from)) | BIT(rule->rook_to);
+        return (rookAttacks(ksq, after) & orthogonal) || (bishopAttacks(ksq, after) & diagonal);
     }
 
-    // Consume the double pushed pawn in case of en passant
     V2 epi = b->en_passant_target_idx;
-    bool is_ep_capture = stype == pawn && (di.x == epi.x && di.y == epi.y);
+    bool is_ep_capture = p.type == pawn && b->has_en_passant_target && to == SQ(epi.x, epi.y);
     if (is_ep_capture) {
-        int direction = (scolor == black) ? 1 : -1;
-        int one_backwards = di.y - direction;
-        b->cells[one_backwards][di.x].piece = (Piece){.type = no_type, .color = no_color};
+        int direction = (p.color == black) ? 1 : -1;
+        after &= ~BIT(SQ(epi.x, epi.y - direction));
+        return (rookAttacks(ksq, after) & orthogonal) || (bishopAttacks(ksq, after) & diagonal);
     }
 
-    // Play move sound
-    if (move_is_capturing || is_ep_capture)
-        PlaySound(sounds[capture_sound]);
-    else
-        PlaySound(sounds[move_sound]);
+    return false;
+}
 
-    b->move_pending = false;
-    b->active_cell = NULL;
-    changeTurn(b);
+// Checks a single move of the side to move without generating other moves,
+// using masks recorded for the position. promo must name the promoted piece
+// when a pawn reaches the last rank, and be no_type otherwise
+bool isLegalMove(const Board *b, int from, int to, enum PieceType promo)
+{
+    if (from < 0 || from >= 64 || to < 0 || to >= 64 || from == to || b->king_sq < 0)
+        return false;
+
+    enum PieceColor us = b->turn;
+    enum PieceColor them = (us == black) ? white : black;
+    Piece p = b->cells[SQ_Y(from)][SQ_X(from)].piece;
+    if (p.color != us)
+        return false;
+
+    Mask occupied = b->occupied[black] | b->occupied[white];
+    int ksq = b->king_sq;
+
+    // Castling: path clear apart from king and rook, and nothing the king
+    // crosses is attacked once both have left their cells
+    int side = (p.type == king) ? castlingSide(b, us, from, to) : -1;
+    if (side != -1) {
+        const CastlingRule *rule = castlingRule(b, us, side);
+        Mask others = occupied & ~BIT(from) & ~BIT(rule->rook_from);
+        if (b->checkers || promo != no_type || (others & rule->path) ||
+            !(b->pieces[us][rook] & BIT(rule->rook_from)))
+            return false;
+        Mask after = others | BIT(rule->rook_to);
+        Mask safe = rule->safe;
+        while (safe)
+            if (attackersTo(b, popLsb(&safe), after) & b->occupied[them])
+                return false;
+        return true;
+    }
 
-    b->has_en_passant_target = false;
-    if (stype == pawn) {
-        // Handle promotion of pawns
-        int promoting_y = (scolor == black) ? 7 : 0;
-        if (di.y == promoting_y) {
-            b->promotion_pending = true;
-            b->promoting_cell = move.dst;
-            return;
-        }
+    if (b->occupied[us] & BIT(to))
+        return false;
 
-        // Record en passant target in case of double pawn push
-        int starting_y = (scolor == black) ? 1 : 6;
-        int direction = (scolor == black) ? 1 : -1;
-        int two_forward = starting_y + 2 * direction;
-        bool is_double_pawn_push = (si.y == starting_y && di.y == two_forward);
-        if (is_double_pawn_push) {
-            b->en_passant_target_idx = (V2){.y = starting_y + direction, .x = si.x};
-            b->has_en_passant_target = true;
-        }
+    bool reaches_last_rank = p.type == pawn && SQ_Y(to) == ((us == black) ? 7 : 0);
+    bool valid_promo = promo == queen || promo == rook || promo == bishop || promo == knight;
+    if (reaches_last_rank ? !valid_promo : promo != no_type)
+        return false;
+
+    if (p.type == king) {
+        // King steps to a cell not attacked once it has left its own
+        if (!(kingAttacks(from) & BIT(to)))
+            return false;
+        return !(attackersTo(b, to, occupied ^ BIT(from)) & b->occupied[them] & ~BIT(to));
     }
 
-    recordStateChangesAfterMove(b);
+    V2 epi = b->en_passant_target_idx;
+    bool is_ep_capture = false;
+    if (p.type == pawn) {
+        int direction = (us == black) ? 1 : -1;
+        int starting_y = (us == black) ? 1 : 6;
+        int one_forward = from + 8 * direction;
+        is_ep_capture = b->has_en_passant_target && to == SQ(epi.x, epi.y) &&
+                        (pawnAttacks(us, from) & BIT(to));
+
+        bool single_push = to == one_forward && !(occupied & BIT(to));
+        bool double_push = SQ_Y(from) == starting_y && to == one_forward + 8 * direction &&
+                           !(occupied & (BIT(one_forward) | BIT(to)));
+        bool capture = (pawnAttacks(us, from) & b->occupied[them] & BIT(to)) != 0;
+        if (!single_push && !double_push && !capture && !is_ep_capture)
+            return false;
+    }
+    else if (!(pieceAttacks(p, from, occupied) & BIT(to))) {
+        return false;
+    }
+
+    // En passant removes two pieces from the capturing rank, check all lines again
+    if (is_ep_capture) {
+        int captured = SQ(epi.x, SQ_Y(from));
+        Mask after = (occupied ^ BIT(from) ^ BIT(captured)) | BIT(to);
+        return !(attackersTo(b, ksq, after) & b->occupied[them] & ~BIT(captured));
+    }
+
+    // Double check leaves only king moves, a single check must be captured or blocked
+    if (b->checkers) {
+        if (b->checkers & (b->checkers - 1))
+            return false;
+        int checker = lsb(b->checkers);
+        if (!((lineBetween(ksq, checker) | b->checkers) & BIT(to)))
+            return false;
+    }
+
+    // Pinned pieces stay on the line through their king
+    if ((b->pinned & BIT(from)) && !(lineThrough(ksq, from) & BIT(to)))
+        return false;
+
+    return true;
+}
+
+// Cells a piece might move to, before checking legality. Its legal moves
+// can only change when one of these cells, or its own, changes
+Mask candidateTargets(const Board *b, int from)
+{
+    Piece p = b->cells[SQ_Y(from)][SQ_X(from)].piece;
+    Mask occupied = b->occupied[black] | b->occupied[white];
+    Mask targets = pieceAttacks(p, from, occupied);
+
+    if (p.type == pawn) {
+        int direction = (p.color == black) ? 1 : -1;
+        for (int y = SQ_Y(from) + direction, k = 0; k < 2 && 0 <= y && y < 8; y += direction, k++)
+            targets |= BIT(SQ(SQ_X(from), y));
+    }
+    if (p.type == king) {
+        for (int side = queenside; side <= kingside; side++)
+            if (b->castling_rights & CASTLE_RIGHT(p.color, side))
+                targets |= BIT(castlingTarget(b, p.color, side));
+    }
+    return targets;
+}
+
+// Cells the piece of the side to move on from can legally move to
+Mask legalTargets(const Board *b, int from)
+{
+    Piece p = b->cells[SQ_Y(from)][SQ_X(from)].piece;
+    Mask targets = candidateTargets(b, from);
+    Mask legal = 0;
+
+    while (targets) {
+        int to = popLsb(&targets);
+        bool promoting = p.type == pawn && (SQ_Y(to) == 0 || SQ_Y(to) == 7);
+        if (isLegalMove(b, from, to, promoting ? queen : no_type))
+            legal |= BIT(to);
+    }
+    return legal;
+}
+
+// Whether the side to move has any move, from moves recorded by
+// recordLegalMoves
+bool hasLegalMove(const Board *b)
+{
+    Mask pieces = b->occupied[b->turn];
+    while (pieces)
+        if (b->legal_moves[popLsb(&pieces)])
+            return true;
+    return false;
+}
+
+// Whether the game ended by mate or any of the draws
+bool gameOver(const Board *b)
+{
+    return b->checkmate || b->draw_by_fifty_move || b->draw_by_stalemate ||
+           b->draw_by_repetition || b->draw_by_insufficient_material;
 }
 
 void changeTurn(Board *b)
@@ -6,14 +6,28 @@
 
 Board initBoard(void);
 Board initBoardFromFEN(char *fen);
-PromotionWindow initPromotionWindow(void);
-void generateFEN(Board b);
+Board initBoard960(int id);
+void generateFEN(const Board *b);
+bool normalizeFEN(const char *line, char *fen, int size);
+double clockSeconds(void);
+int suggestedWorkerCount(void);
+void copyBoard(Board *dst, const Board *src);
 V2 cellPosByIdx(int x, int y);
 V2 cellIdxByPos(int pos_x, int pos_y);
 bool validCellIdx(int x, int y);
-bool emptyCell(Cell c);
+bool emptyCell(const Cell *c);
 void movePiece(Cell *from, Cell *to);
 void makeMove(const Move m, Board *b);
+void completePromotion(Board *b, enum PieceType type);
+bool givesCheck(const Board *b, const Move m);
+bool isLegalMove(const Board *b, int from, int to, enum PieceType promo);
+Mask candidateTargets(const Board *b, int from);
+Mask legalTargets(const Board *b, int from);
+bool hasLegalMove(const Board *b);
+bool gameOver(const Board *b);
 void changeTurn(Board *b);
+const CastlingRule *castlingRule(const Board *b, enum PieceColor color, enum CastlingSide side);
+int castlingTarget(const Board *b, enum PieceColor color, enum CastlingSide side);
+int castlingSide(const Board *b, enum PieceColor color, int from, int to);
 
 #endif // TOOLS_H
@@ -0,0 +1,314 @@
+// Engine alone, speaking UCI over stdin and stdout for tournament managers
+// and other GUIs. Built without raylib as chess-uci
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "search.h"
+#include "masks.h"
+#include "tools.h"
+
+#define ENGINE_NAME "chess-c"
+
+// Position commands of long games run to a few thousand chars
+#define LINE_SIZE 65536
+
+// Searches recurse with their move lists on the stack
+#define SEARCH_STACK_SIZE (1024 * 1024)
+
+// Clock use: the moves left are guessed when the GUI doesn't say, and some
+// time is kept back for the GUI reading the move
+#define DEFAULT_MOVES_TO_GO     30
+#define MOVE_OVERHEAD_MILLIS    30
+
+#define MAX_HASH_MB 4096
+
+// By piece type, in order with enum PieceType
+static const char promotion_letters[] = "kqbnr";
+
+static Position game;
+static int threads = 1;
+
+// The search runs on its own thread so stop can be read while it does.
+// Infinite searches hold their bestmove until stopped, as UCI asks
+static pthread_t search_thread;
+static bool searching = false;
+static atomic_bool stop_search;
+static pthread_mutex_t stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stopped = PTHREAD_COND_INITIALIZER;
+static Position search_root;
+static SearchLimits search_limits;
+static bool search_infinite;
+static int reported_depth;
+
+static void printInfo(const SearchReport *r, void *arg)
+{
+    (void)arg;
+    long millis = (long)(r->seconds * 1000);
+    if (r->depth == reported_depth || r->pv_length == 0) {
+        printf("info nodes %ld nps %ld time %ld\n", r->nodes, nodesPerSecond(r), millis);
+        fflush(stdout);
+        return;
+    }
+    reported_depth = r->depth;
+
+    char score[16];
+    if (mateIn(r->score) != 0)
+        sprintf(score, "mate %d", mateIn(r->score));
+    else
+        sprintf(score, "cp %d", r->score);
+    printf("info depth %d score %s nodes %ld nps %ld time %ld pv", r->depth, score, r->nodes,
+           nodesPerSecond(r), millis);
+    for (int i = 0; i < r->pv_length; i++) {
+        char move[6];
+        moveText(r->pv[i], move);
+        printf(" %s", move);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static void *searchLoop(void *arg)
+{
+    (void)arg;
+    SearchReport r = searchPosition(&search_root, search_limits, printInfo, NULL);
+
+    pthread_mutex_lock(&stop_lock);
+    while (search_infinite && !atomic_load(&stop_search))
+        pthread_cond_wait(&stopped, &stop_lock);
+    pthread_mutex_unlock(&stop_lock);
+
+    char move[6] = "0000";
+    if (r.best.from != r.best.to)
+        moveText(r.best, move);
+    printf("bestmove %s\n", move);
+    fflush(stdout);
+    return NULL;
+}
+
+// Stops the search, if any, once it printed its bestmove
+static void stopSearch(void)
+{
+    if (!searching)
+        return;
+    pthread_mutex_lock(&stop_lock);
+    atomic_store(&stop_search, true);
+    pthread_cond_broadcast(&stopped);
+    pthread_mutex_unlock(&stop_lock);
+    pthread_join(search_thread, NULL);
+    searching = false;
+}
+
+// Plays a move given as e2e4 or e7e8q on p. Castling moves go to the
+// castling target, the king's cell in standard chess and the rook's in
+// chess960, as UCI writes them
+static bool playMoveText(Position *p, const char *text)
+{
+    if (strlen(text) < 4 || strlen(text) > 5 || text[0] < 'a' || text[0] > 'h' || text[1] < '1' ||
+        text[1] > '8' || text[2] < 'a' || text[2] > 'h' || text[3] < '1' || text[3] > '8')
+        return false;
+    int from = SQ(text[0] - 'a', '8' - text[1]);
+    int to = SQ(text[2] - 'a', '8' - text[3]);
+    const char *promotion = (text[4] != '\0') ? strchr(promotion_letters, text[4]) : NULL;
+    SearchMove wanted = {from, to, (promotion != NULL) ? promotion - promotion_letters : no_type, quiet_move};
+
+    SearchMove moves[256];
+    int count = generateMoves(p, moves);
+    for (int i = 0; i < count; i++) {
+        if (!sameMove(moves[i], wanted))
+            continue;
+        PositionUndo u;
+        if (!makePositionMove(p, moves[i], &u))
+            return false;
+        trimKeys(p);
+        return true;
+    }
+    return false;
+}
+
+// position [startpos | fen <fen>] [moves <move>...]
+static void setPosition(char *args)
+{
+    char *moves = strstr(args, "moves");
+    if (moves != NULL)
+        *moves++ = '\0';
+
+    Board b;
+    args += strspn(args, " ");
+    if (strncmp(args, "startpos", strlen("startpos")) == 0) {
+        b = initBoard();
+    }
+    else if (strncmp(args, "fen ", strlen("fen ")) == 0) {
+        // A malformed FEN would leave the board half set up
+        char fen[128];
+        if (!normalizeFEN(args + strlen("fen "), fen, sizeof(fen))) {
+            printf("info string invalid fen\n");
+            return;
+        }
+        b = initBoardFromFEN(fen);
+    }
+    else {
+        return;
+    }
+    positionFromBoard(&game, &b);
+
+    if (moves == NULL)
+        return;
+    strtok(moves, " ");
+    char *token;
+    while ((token = strtok(NULL, " ")) != NULL) {
+        if (!playMoveText(&game, token)) {
+            printf("info string illegal move %s\n", token);
+            return;
+        }
+    }
+}
+
+// Time for a move out of time left on the clock
+static int moveMillis(int time, int increment, int moves_to_go)
+{
+    int moves = (moves_to_go > 0) ? moves_to_go : DEFAULT_MOVES_TO_GO;
+    int millis = time / moves + increment * 3 / 4;
+    if (millis > time - MOVE_OVERHEAD_MILLIS)
+        millis = time - MOVE_OVERHEAD_MILLIS;
+    return (millis > 1) ? millis : 1;
+}
+
+// go [depth n] [nodes n] [movetime ms] [wtime ms btime ms winc ms binc ms
+// movestogo n] [infinite]
+static void startSearch(char *args)
+{
+    int time[2] = {0, 0};
+    int increment[2] = {0, 0};
+    int moves_to_go = 0;
+    int movetime = 0;
+    SearchLimits limits = {.threads = threads, .stop = &stop_search};
+    bool infinite = false;
+
+    char *token = strtok(args, " ");
+    while (token != NULL) {
+        char *value = strtok(NULL, " ");
+        long number = (value != NULL) ? atol(value) : 0;
+        if (strcmp(token, "depth") == 0)
+            limits.depth = number;
+        else if (strcmp(token, "nodes") == 0)
+            limits.nodes = number;
+        else if (strcmp(token, "movetime") == 0)
+            movetime = number;
+        else if (strcmp(token, "wtime") == 0)
+            time[white] = number;
+        else if (strcmp(token, "btime") == 0)
+            time[black] = number;
+        else if (strcmp(token, "winc") == 0)
+            increment[white] = number;
+        else if (strcmp(token, "binc") == 0)
+            increment[black] = number;
+        else if (strcmp(token, "movestogo") == 0)
+            moves_to_go = number;
+        else {
+            // Flags take no value, the next token is a keyword again
+            infinite = infinite || strcmp(token, "infinite") == 0;
+            token = value;
+            continue;
+        }
+        token = strtok(NULL, " ");
+    }
+
+    if (movetime > 0)
+        limits.millis = movetime;
+    else if (time[game.turn] > 0)
+        limits.millis = moveMillis(time[game.turn], increment[game.turn], moves_to_go);
+    infinite = infinite || (limits.depth == 0 && limits.nodes == 0 && limits.millis == 0);
+
+    search_root = game;
+    search_limits = limits;
+    search_infinite = infinite;
+    reported_depth = 0;
+    atomic_store(&stop_search, false);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SEARCH_STACK_SIZE);
+    searching = pthread_create(&search_thread, &attr, searchLoop, NULL) == 0;
+    pthread_attr_destroy(&attr);
+}
+
+// setoption name <name> [value <value>]
+static void setOption(char *args)
+{
+    char *name = strstr(args, "name ");
+    char *value = strstr(args, " value ");
+    if (name == NULL)
+        return;
+    name += strlen("name ");
+    if (value != NULL) {
+        *value = '\0';
+        value += strlen(" value ");
+    }
+
+    int number = (value != NULL) ? atoi(value) : 0;
+    if (strcasecmp(name, "Hash") == 0 && number >= 1 && number <= MAX_HASH_MB)
+        setTableSize(number);
+    else if (strcasecmp(name, "Threads") == 0 && number >= 1 && number <= MAX_SEARCH_THREADS)
+        threads = number;
+    else
+        printf("info string unknown option %s\n", name);
+}
+
+int main(void)
+{
+    static char line[LINE_SIZE];
+
+    initSearch();
+    Board b = initBoard();
+    positionFromBoard(&game, &b);
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *args = strchr(line, ' ');
+        if (args != NULL)
+            *args++ = '\0';
+        else
+            args = line + strlen(line);
+
+        if (strcmp(line, "uci") == 0) {
+            printf("id name %s\n", ENGINE_NAME);
+            printf("id author the chess-c authors\n");
+            printf("option name Hash type spin default %d min 1 max %d\n", DEFAULT_TABLE_MB, MAX_HASH_MB);
+            printf("option name Threads type spin default 1 min 1 max %d\n", MAX_SEARCH_THREADS);
+            printf("uciok\n");
+        }
+        else if (strcmp(line, "isready") == 0) {
+            printf("readyok\n");
+        }
+        else if (strcmp(line, "ucinewgame") == 0) {
+            stopSearch();
+            clearSearch();
+        }
+        else if (strcmp(line, "setoption") == 0) {
+            stopSearch();
+            setOption(args);
+        }
+        else if (strcmp(line, "position") == 0) {
+            stopSearch();
+            setPosition(args);
+        }
+        else if (strcmp(line, "go") == 0) {
+            stopSearch();
+            startSearch(args);
+        }
+        else if (strcmp(line, "stop") == 0) {
+            stopSearch();
+        }
+        else if (strcmp(line, "quit") == 0) {
+            break;
+        }
+        fflush(stdout);
+    }
+
+    stopSearch();
+    return 0;
+}
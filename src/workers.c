@@ -0,0 +1,133 @@
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "workers.h"
+
+#define MAX_WORKERS 15
+
+// Jobs keep their boards in heap scratch memory, so pool threads get small
+// stacks. Check frame sizes with make stack-usage
+#define WORKER_STACK_SIZE (64 * 1024)
+
+static pthread_t threads[MAX_WORKERS];
+static int worker_count = 0;
+static bool stopping = false;
+
+// Current batch, guarded by lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+static WorkerJob current_job;
+static void *current_arg;
+static int job_count = 0;
+static int next_index = 0;
+static int done_count = 0;
+
+static _Thread_local bool in_worker = false;
+static _Thread_local int thread_worker = 0;
+
+static void *workerLoop(void *p)
+{
+    int worker = (int)(long)p;
+    in_worker = true;
+    thread_worker = worker;
+
+    pthread_mutex_lock(&lock);
+    while (!stopping) {
+        if (next_index >= job_count) {
+            pthread_cond_wait(&work_ready, &lock);
+            continue;
+        }
+        int index = next_index++;
+        WorkerJob job = current_job;
+        void *arg = current_arg;
+        pthread_mutex_unlock(&lock);
+
+        job(arg, index, worker);
+
+        pthread_mutex_lock(&lock);
+        if (++done_count == job_count)
+            pthread_cond_signal(&work_done);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+// Starts count pool threads that stay alive until stopWorkers
+void startWorkers(int count)
+{
+    if (worker_count > 0)
+        return;
+    if (count > MAX_WORKERS)
+        count = MAX_WORKERS;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+
+    stopping = false;
+    for (int i = 0; i < count; i++) {
+        if (pthread_create(&threads[i], &attr, workerLoop, (void *)(long)(i + 1)) != 0)
+            break;
+        worker_count++;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void stopWorkers(void)
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < worker_count; i++)
+        pthread_join(threads[i], NULL);
+    worker_count = 0;
+}
+
+int workerCount(void)
+{
+    return worker_count;
+}
+
+// Worker number of the calling thread, 0 outside the pool
+int currentWorker(void)
+{
+    return thread_worker;
+}
+
+// Runs job for indices 0..count-1 across the pool and returns once all are
+// done. Called from inside a job, it runs serially on that thread. The pool
+// runs one batch at a time and callers outside it share worker number 0, so
+// only one thread outside the pool may call it, the GUI thread
+void runJobs(WorkerJob job, void *arg, int count)
+{
+    if (worker_count == 0 || in_worker) {
+        for (int i = 0; i < count; i++)
+            job(arg, i, thread_worker);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    current_job = job;
+    current_arg = arg;
+    job_count = count;
+    next_index = 0;
+    done_count = 0;
+    pthread_cond_broadcast(&work_ready);
+
+    while (next_index < job_count) {
+        int index = next_index++;
+        pthread_mutex_unlock(&lock);
+        job(arg, index, 0);
+        pthread_mutex_lock(&lock);
+        done_count++;
+    }
+    while (done_count < job_count)
+        pthread_cond_wait(&work_done, &lock);
+
+    job_count = 0;
+    next_index = 0;
+    pthread_mutex_unlock(&lock);
+}
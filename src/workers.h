@@ -0,0 +1,14 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+// Job run once per index, worker is 0 for the calling thread and
+// 1..workerCount() for pool threads, for picking per-worker scratch memory
+typedef void (*WorkerJob)(void *arg, int index, int worker);
+
+void startWorkers(int count);
+void stopWorkers(void);
+int workerCount(void);
+int currentWorker(void);
+void runJobs(WorkerJob job, void *arg, int count);
+
+#endif // WORKERS_H
@@ -0,0 +1,64 @@
+#include "zobrist.h"
+#include "masks.h"
+
+uint64_t piece_keys[2][6][64];
+uint64_t castling_keys[16];
+uint64_t en_passant_keys[8];
+uint64_t white_key;
+static bool zobrist_ready = false;
+
+// splitmix64, seeded the same every run so that keys match the tables
+// baked by tools/bake_openings.c
+static uint64_t nextKey(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Fills key tables, safe to call more than once
+void initZobrist(void)
+{
+    if (zobrist_ready)
+        return;
+
+    uint64_t state = 0x636865737363ULL;
+    for (int c = 0; c < 2; c++)
+        for (int t = 0; t < 6; t++)
+            for (int sq = 0; sq < 64; sq++)
+                piece_keys[c][t][sq] = nextKey(&state);
+    castling_keys[0] = 0;
+    for (int r = 1; r < 16; r++)
+        castling_keys[r] = nextKey(&state);
+    for (int x = 0; x < 8; x++)
+        en_passant_keys[x] = nextKey(&state);
+    white_key = nextKey(&state);
+
+    zobrist_ready = true;
+}
+
+// Key of the piece placement, side to move, castling rights and en passant
+// target. The target only counts when a pawn stands by to take it, else
+// positions differing just by it would get different keys. Uses the masks,
+// so recordMasks should have been called
+uint64_t positionKey(const Board *b)
+{
+    uint64_t key = castling_keys[b->castling_rights & ALL_CASTLE_RIGHTS];
+    for (int c = 0; c < 2; c++) {
+        for (int t = 0; t < 6; t++) {
+            Mask m = b->pieces[c][t];
+            while (m)
+                key ^= piece_keys[c][t][popLsb(&m)];
+        }
+    }
+    if (b->has_en_passant_target) {
+        V2 t = b->en_passant_target_idx;
+        enum PieceColor them = (b->turn == white) ? black : white;
+        if (pawnAttacks(them, SQ(t.x, t.y)) & b->pieces[b->turn][pawn])
+            key ^= en_passant_keys[t.x];
+    }
+    if (b->turn == white)
+        key ^= white_key;
+    return key;
+}
@@ -0,0 +1,16 @@
+#ifndef ZOBRIST_H
+#define ZOBRIST_H
+
+#include "declarations.h"
+
+// Key tables, filled by initZobrist. Searches keep keys up to date move by
+// move with these, see position.c
+extern uint64_t piece_keys[2][6][64];
+extern uint64_t castling_keys[16];      // by castling_rights
+extern uint64_t en_passant_keys[8];     // by file of the target
+extern uint64_t white_key;
+
+void initZobrist(void);
+uint64_t positionKey(const Board *b);
+
+#endif // ZOBRIST_H
@@ -0,0 +1,237 @@
+// Bakes derived state of the positions in the first plies of a standard game
+// into a C source, see src/openings.h. Built and run by the Makefile and the
+// build scripts, against the rules built without a table:
+//
+//     bake_openings [plies] > src/opening_table.c
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "masks.h"
+#include "openings.h"
+#include "tools.h"
+#include "zobrist.h"
+
+#define DEFAULT_PLIES 3
+
+#define MAX_MOVES 256
+
+typedef struct {
+    uint64_t key;
+    Mask dangerous[2];
+    OpeningMove moves[MAX_MOVES];
+    int count;
+} Baked;
+
+static Baked *baked = NULL;
+static int baked_count = 0;
+static int baked_capacity = 0;
+
+static void bake(const Board *b)
+{
+    if (baked_count == baked_capacity) {
+        baked_capacity = baked_capacity ? baked_capacity * 2 : 1024;
+        baked = realloc(baked, sizeof(Baked) * baked_capacity);
+        assert(baked != NULL && "Couldn't allocate baked positions");
+    }
+
+    Baked *p = &baked[baked_count++];
+    memset(p, 0, sizeof(*p));
+    p->key = positionKey(b);
+    for (int sq = 0; sq < 64; sq++)
+        for (int c = 0; c < 2; c++)
+            if (b->cells[SQ_Y(sq)][SQ_X(sq)].is_dangerous[c])
+                p->dangerous[c] |= BIT(sq);
+
+    Mask pieces = b->occupied[b->turn];
+    while (pieces) {
+        int from = popLsb(&pieces);
+        Mask targets = b->legal_moves[from];
+        while (targets) {
+            assert(p->count < MAX_MOVES);
+            p->moves[p->count++] = (OpeningMove){.from = from, .to = popLsb(&targets)};
+        }
+    }
+}
+
+// Bakes b and every position reachable from it in plies moves
+static void collect(const Board *b, int plies)
+{
+    bake(b);
+    if (plies == 0)
+        return;
+
+    Mask pieces = b->occupied[b->turn];
+    while (pieces) {
+        int from = popLsb(&pieces);
+        Mask targets = b->legal_moves[from];
+        while (targets) {
+            int to = popLsb(&targets);
+            Board next = *b;
+            Move m = {
+                .src = &(next.cells[SQ_Y(from)][SQ_X(from)]),
+                .dst = &(next.cells[SQ_Y(to)][SQ_X(to)]),
+            };
+            makeMove(m, &next);
+            if (!next.promotion_pending)    // too early in the game for those
+                collect(&next, plies - 1);
+        }
+    }
+}
+
+static int byKey(const void *a, const void *b)
+{
+    uint64_t ka = ((const Baked *)a)->key;
+    uint64_t kb = ((const Baked *)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+// Drops transpositions, positions reached by more moves than one
+static void dedupe(void)
+{
+    qsort(baked, baked_count, sizeof(Baked), byKey);
+    int n = 0;
+    for (int i = 0; i < baked_count; i++) {
+        if (n > 0 && baked[n - 1].key == baked[i].key) {
+            assert(baked[n - 1].count == baked[i].count && "Key collision");
+            continue;
+        }
+        baked[n++] = baked[i];
+    }
+    baked_count = n;
+}
+
+typedef struct {
+    int bucket;
+    int size;
+    int *members;
+} Bucket;
+
+static int bySizeDescending(const void *a, const void *b)
+{
+    return ((const Bucket *)b)->size - ((const Bucket *)a)->size;
+}
+
+// Finds a seed per bucket so that all keys land in distinct slots, filling
+// largest buckets first while most slots are free. Returns baked index by
+// slot, -1 for unused ones
+static int *perfectHash(int buckets, int slots, uint32_t *seeds)
+{
+    Bucket *by_bucket = calloc(buckets, sizeof(Bucket));
+    int *slot_owner = malloc(sizeof(int) * slots);
+    int64_t *tried = malloc(sizeof(int64_t) * slots);
+    assert(by_bucket && slot_owner && tried);
+
+    for (int i = 0; i < buckets; i++) {
+        by_bucket[i].bucket = i;
+        by_bucket[i].members = malloc(sizeof(int) * baked_count);
+    }
+    for (int i = 0; i < baked_count; i++) {
+        Bucket *bk = &by_bucket[openingBucket(baked[i].key, buckets)];
+        bk->members[bk->size++] = i;
+    }
+    qsort(by_bucket, buckets, sizeof(Bucket), bySizeDescending);
+
+    for (int s = 0; s < slots; s++) {
+        slot_owner[s] = -1;
+        tried[s] = -1;
+    }
+    for (int i = 0; i < buckets; i++) {
+        Bucket *bk = &by_bucket[i];
+        seeds[bk->bucket] = 0;
+        if (bk->size == 0)
+            continue;
+
+        // tried marks slots taken by this bucket under the current seed
+        for (uint32_t seed = 0;; seed++) {
+            assert(seed < 10000000 && "No seed found, use more slots");
+            bool fits = true;
+            int64_t tag = (int64_t)seed * buckets + i;
+            for (int k = 0; k < bk->size && fits; k++) {
+                int s = openingSlot(baked[bk->members[k]].key, seed, slots);
+                fits = slot_owner[s] == -1 && tried[s] != tag;
+                tried[s] = tag;
+            }
+            if (!fits)
+                continue;
+
+            for (int k = 0; k < bk->size; k++)
+                slot_owner[openingSlot(baked[bk->members[k]].key, seed, slots)] = bk->members[k];
+            seeds[bk->bucket] = seed;
+            break;
+        }
+    }
+
+    for (int i = 0; i < buckets; i++)
+        free(by_bucket[i].members);
+    free(by_bucket);
+    free(tried);
+    return slot_owner;
+}
+
+int main(int argc, char **argv)
+{
+    int plies = (argc > 1) ? atoi(argv[1]) : DEFAULT_PLIES;
+    if (plies < 0) {
+        fprintf(stderr, "usage: %s [plies]\n", argv[0]);
+        return 1;
+    }
+
+    Board b = initBoard();
+    collect(&b, plies);
+    dedupe();
+
+    int buckets = baked_count / 4 + 1;
+    int slots = baked_count + baked_count / 8 + 1;
+    uint32_t *seeds = malloc(sizeof(uint32_t) * buckets);
+    assert(seeds != NULL);
+    int *owners = perfectHash(buckets, slots, seeds);
+
+    printf("// Generated by tools/bake_openings.c, do not edit\n");
+    printf("// %d positions up to %d plies from the standard start\n\n", baked_count, plies);
+    printf("#include \"openings.h\"\n\n");
+    printf("const int opening_plies = %d;\n", plies);
+    printf("const int opening_buckets = %d;\n", buckets);
+    printf("const int opening_slots = %d;\n\n", slots);
+
+    printf("const uint32_t opening_seeds[] = {");
+    for (int i = 0; i < buckets; i++)
+        printf("%s%u,", (i % 16 == 0) ? "\n    " : " ", seeds[i]);
+    printf("\n};\n\n");
+
+    printf("const OpeningEntry opening_entries[] = {\n");
+    uint32_t moves = 0;
+    for (int s = 0; s < slots; s++) {
+        if (owners[s] == -1) {
+            printf("    {0},\n");
+            continue;
+        }
+        const Baked *p = &baked[owners[s]];
+        printf("    {0x%016llxULL, {0x%llxULL, 0x%llxULL}, %u, %d},\n", (unsigned long long)p->key,
+               (unsigned long long)p->dangerous[black], (unsigned long long)p->dangerous[white],
+               moves, p->count);
+        moves += p->count;
+    }
+    printf("};\n\n");
+
+    printf("const OpeningMove opening_moves[] = {\n");
+    for (int s = 0; s < slots; s++) {
+        if (owners[s] == -1)
+            continue;
+        const Baked *p = &baked[owners[s]];
+        for (int k = 0; k < p->count; k++) {
+            const char *sep = (k % 10 != 0) ? " " : (k > 0) ? "\n    " : "    ";
+            printf("%s{%d, %d},", sep, p->moves[k].from, p->moves[k].to);
+        }
+        if (p->count > 0)
+            printf("\n");
+    }
+    printf("};\n");
+
+    free(owners);
+    free(seeds);
+    free(baked);
+    return 0;
+}
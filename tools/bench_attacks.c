@@ -0,0 +1,145 @@
+// Times danger maps of many independent positions, as bulk labelling of a
+// dataset computes them: recordDangerousCells on one board at a time
+// against the batched attack fills, on AVX2 where the cpu has it and on the
+// scalar fallback. Every batched result is checked against
+// recordDangerousCells. Built by make bench-attacks:
+//
+//     bench_attacks [positions.epd]
+//
+// Positions are FEN or EPD lines of the file, or a few built in ones
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "attacks.h"
+#include "masks.h"
+#include "recorders.h"
+#include "tools.h"
+
+#define BOARD_COUNT     1024
+#define ROUNDS          200
+#define MAX_POSITIONS   BOARD_COUNT
+#define LINE_SIZE       512
+
+static char *fens[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "4k3/8/8/8/8/8/8/4K2R w K - 0 1",
+    "8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1",
+};
+
+typedef void (*BatchKernel)(AttackBatch *batches, int count);
+
+static Board *boards;
+static int board_count;
+static Mask expected[BOARD_COUNT][2];
+static AttackBatch batches[BOARD_COUNT / ATTACK_BATCH_LANES];
+
+// Cells of a board dangerous for each color, as masks
+static void dangerousMasks(const Board *b, Mask dangerous[2])
+{
+    dangerous[black] = dangerous[white] = 0;
+    for (int sq = 0; sq < 64; sq++)
+        for (int c = 0; c < 2; c++)
+            if (b->cells[SQ_Y(sq)][SQ_X(sq)].is_dangerous[c])
+                dangerous[c] |= BIT(sq);
+}
+
+// Boards of the positions, repeated until all BOARD_COUNT are set up
+static bool loadBoards(FILE *f)
+{
+    static char positions[MAX_POSITIONS][LINE_SIZE];
+    int count = 0;
+    if (f == NULL) {
+        for (size_t i = 0; i < sizeof(fens) / sizeof(fens[0]); i++)
+            strcpy(positions[count++], fens[i]);
+    }
+    else {
+        char line[LINE_SIZE];
+        for (long number = 1; count < MAX_POSITIONS && fgets(line, sizeof(line), f); number++) {
+            if (normalizeFEN(line, positions[count], LINE_SIZE))
+                count++;
+            else if (line[strspn(line, " \t\r\n")] != '\0')
+                fprintf(stderr, "line %ld: invalid position\n", number);
+        }
+    }
+    if (count == 0)
+        return false;
+
+    boards = malloc(BOARD_COUNT * sizeof(Board));
+    if (boards == NULL)
+        return false;
+    board_count = BOARD_COUNT;
+    for (int i = 0; i < board_count; i++) {
+        boards[i] = initBoardFromFEN(positions[i % count]);
+        recordDangerousCells(&boards[i]);
+        dangerousMasks(&boards[i], expected[i]);
+    }
+    printf("%d positions on %d boards\n", count, board_count);
+    return true;
+}
+
+// Microseconds per position of recordDangerousCells
+static double timeSingle(void)
+{
+    double start = clockSeconds();
+    for (int r = 0; r < ROUNDS; r++)
+        for (int i = 0; i < board_count; i++)
+            recordDangerousCells(&boards[i]);
+    return (clockSeconds() - start) * 1e6 / ((double)ROUNDS * board_count);
+}
+
+// Microseconds per position of a batch kernel, loading and storing lanes
+// included. Checks the boards against recordDangerousCells afterwards
+static double timeBatched(BatchKernel kernel, const char *name)
+{
+    int count = board_count / ATTACK_BATCH_LANES;
+    double start = clockSeconds();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < board_count; i++)
+            loadAttackBatchLane(&batches[i / ATTACK_BATCH_LANES], i % ATTACK_BATCH_LANES, &boards[i]);
+        kernel(batches, count);
+        for (int i = 0; i < board_count; i++)
+            storeDangerousCells(&batches[i / ATTACK_BATCH_LANES], i % ATTACK_BATCH_LANES, &boards[i]);
+    }
+    double micros = (clockSeconds() - start) * 1e6 / ((double)ROUNDS * board_count);
+
+    for (int i = 0; i < board_count; i++) {
+        Mask dangerous[2];
+        dangerousMasks(&boards[i], dangerous);
+        if (dangerous[black] != expected[i][black] || dangerous[white] != expected[i][white]) {
+            fprintf(stderr, "%s: board %d differs from recordDangerousCells\n", name, i);
+            exit(1);
+        }
+    }
+    return micros;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *f = NULL;
+    if (argc > 1 && (f = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (!loadBoards(f)) {
+        fprintf(stderr, "usage: bench_attacks [positions.epd]\n");
+        return 1;
+    }
+    if (f != NULL)
+        fclose(f);
+
+    double single = timeSingle();
+    double batched = timeBatched(computeAttacks, "computeAttacks");
+    double scalar = timeBatched(computeAttacksScalar, "computeAttacksScalar");
+    printf("recordDangerousCells: %.3f us per position\n", single);
+    printf("computeAttacks:       %.3f us per position, %.2fx\n", batched, single / batched);
+    printf("computeAttacksScalar: %.3f us per position, %.2fx\n", scalar, single / scalar);
+    free(boards);
+    return 0;
+}
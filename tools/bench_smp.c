@@ -0,0 +1,61 @@
+// Reports how the search scales with threads: searches a few positions for a
+// fixed time on 1, 2, 4... threads up to one per core and prints the nodes
+// per second of each count against a single thread. Built by make bench-smp:
+//
+//     bench_smp [threads] [millis]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "search.h"
+#include "tools.h"
+
+#define DEFAULT_MILLIS 3000
+
+static char *fens[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+};
+
+// Nodes per second of every position searched on threads threads
+static long benchThreads(int threads, int millis)
+{
+    long nodes = 0;
+    double seconds = 0;
+    for (size_t i = 0; i < sizeof(fens) / sizeof(fens[0]); i++) {
+        Board b = initBoardFromFEN(fens[i]);
+        Position root;
+        positionFromBoard(&root, &b);
+
+        clearSearch();
+        SearchLimits limits = {.millis = millis, .threads = threads};
+        SearchReport r = searchPosition(&root, limits, NULL, NULL);
+        nodes += r.nodes;
+        seconds += r.seconds;
+        printf("  %d threads, position %zu: depth %d, %ld nodes\n", threads, i + 1, r.depth, r.nodes);
+    }
+    return (seconds > 0) ? (long)(nodes / seconds) : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = (argc > 1) ? atoi(argv[1]) : suggestedWorkerCount() + 1;
+    int millis = (argc > 2) ? atoi(argv[2]) : DEFAULT_MILLIS;
+    if (max_threads < 1 || max_threads > MAX_SEARCH_THREADS || millis < 1) {
+        fprintf(stderr, "usage: bench_smp [threads 1-%d] [millis]\n", MAX_SEARCH_THREADS);
+        return 1;
+    }
+    initSearch();
+
+    long single = 0;
+    for (int threads = 1;; threads = (threads * 2 < max_threads) ? threads * 2 : max_threads) {
+        long nps = benchThreads(threads, millis);
+        if (threads == 1)
+            single = nps;
+        printf("%2d threads: %ld knps, %.2fx\n", threads, nps / 1000, single ? (double)nps / single : 0);
+        if (threads == max_threads)
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,227 @@
+// Analyses a file of positions, one FEN or EPD per line, to a fixed depth
+// or node count on one thread per core. Built by make chess-analyze:
+//
+//     chess-analyze [-d depth | -n nodes] [-j threads] [-m megabytes] [-s] [file]
+//
+// Prints each position with its best move (e2e4 notation, as UCI writes
+// it), score in centipawns for the side to move, depth and nodes, as EPD
+// operations, in input order. Lines that aren't positions are echoed and
+// reported on stderr. Lines are read as workers free up, so memory
+// stays bounded however long the file. Workers keep their own table from
+// one position to the next, which makes results depend on which worker
+// got which position; -s clears it before each position instead, so the
+// results are the same on any number of threads
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "search.h"
+#include "tools.h"
+
+#define DEFAULT_DEPTH       8
+#define WORKER_TABLE_MB     16
+#define MAX_WORKERS         256
+#define WORKER_STACK_SIZE   (1024 * 1024)
+#define LINE_SIZE           512
+
+// Positions read ahead of the one printed next, per worker
+#define WINDOW_PER_WORKER   4
+
+typedef struct {
+    char line[LINE_SIZE];
+    char fen[LINE_SIZE];    // the line normalized, if valid
+    bool valid;
+    bool done;
+    SearchReport report;
+} Job;
+
+// Jobs go round a window of slots: read, then taken by a worker, then
+// printed, each in input order. Guarded by lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+static Job *jobs;
+static long window;
+static long read_count = 0;
+static long taken_count = 0;
+static long printed_count = 0;
+static bool input_done = false;
+
+static SearchLimits limits;
+static int table_mb = WORKER_TABLE_MB;
+static bool deterministic = false;
+
+static void *workerLoop(void *arg)
+{
+    (void)arg;
+    SearchTable table = newSearchTable(table_mb);
+    SearchLimits own_limits = limits;
+    own_limits.table = &table;
+
+    pthread_mutex_lock(&lock);
+    while (true) {
+        if (taken_count == read_count) {
+            if (input_done)
+                break;
+            pthread_cond_wait(&job_ready, &lock);
+            continue;
+        }
+        Job *job = &jobs[taken_count++ % window];
+        pthread_mutex_unlock(&lock);
+
+        if (job->valid) {
+            Board b = initBoardFromFEN(job->fen);
+            Position root;
+            positionFromBoard(&root, &b);
+            if (deterministic)
+                clearSearchTable(&table);
+            job->report = searchPosition(&root, own_limits, NULL, NULL);
+        }
+
+        pthread_mutex_lock(&lock);
+        job->done = true;
+        pthread_cond_signal(&job_done);
+    }
+    pthread_mutex_unlock(&lock);
+
+    freeSearchTable(&table);
+    return NULL;
+}
+
+static void printJob(const Job *job, long number)
+{
+    if (!job->valid) {
+        if (job->line[strspn(job->line, " \t\r\n")] != '\0')
+            fprintf(stderr, "line %ld: invalid position\n", number);
+        printf("%s", job->line);
+        return;
+    }
+
+    // The board fields, without the line's own operations and counters
+    char fen[LINE_SIZE];
+    strcpy(fen, job->fen);
+    for (int spaces = 0, i = 0; fen[i] != '\0'; i++) {
+        if (fen[i] == ' ' && ++spaces == 4) {
+            fen[i] = '\0';
+            break;
+        }
+    }
+
+    const SearchReport *r = &job->report;
+    if (r->best.from == r->best.to) {
+        printf("%s acd 0; acn 0;\n", fen);
+        return;
+    }
+    char move[6];
+    moveText(r->best, move);
+    printf("%s bm %s; ce %d;", fen, move, r->score);
+    if (mateIn(r->score) != 0)
+        printf(" dm %d;", mateIn(r->score));
+    printf(" acd %d; acn %ld; pv", r->depth, r->nodes);
+    for (int i = 0; i < r->pv_length; i++) {
+        moveText(r->pv[i], move);
+        printf(" %s", move);
+    }
+    printf(";\n");
+}
+
+int main(int argc, char **argv)
+{
+    int workers = suggestedWorkerCount() + 1;
+    limits = (SearchLimits){.threads = 1};
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n:j:m:s")) != -1) {
+        switch (opt) {
+        case 'd': limits.depth = atoi(optarg); break;
+        case 'n': limits.nodes = atol(optarg); break;
+        case 'j': workers = atoi(optarg); break;
+        case 'm': table_mb = atoi(optarg); break;
+        case 's': deterministic = true; break;
+        default:
+            fprintf(stderr, "usage: chess-analyze [-d depth | -n nodes] [-j threads] [-m megabytes] [-s] [file]\n");
+            return 1;
+        }
+    }
+    if (limits.depth <= 0 && limits.nodes <= 0)
+        limits.depth = DEFAULT_DEPTH;
+    workers = (workers < 1) ? 1 : (workers > MAX_WORKERS) ? MAX_WORKERS : workers;
+    table_mb = (table_mb < 1) ? 1 : table_mb;
+
+    FILE *in = stdin;
+    if (optind < argc && (in = fopen(argv[optind], "r")) == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    // Tables and rules set up once, before workers read them
+    initBoard();
+    window = (long)workers * WINDOW_PER_WORKER;
+    jobs = calloc(window, sizeof(Job));
+    if (jobs == NULL) {
+        fprintf(stderr, "Couldn't allocate jobs\n");
+        return 1;
+    }
+
+    pthread_t threads[MAX_WORKERS];
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+    int started = 0;
+    for (int i = 0; i < workers; i++)
+        if (pthread_create(&threads[started], &attr, workerLoop, NULL) == 0)
+            started++;
+    pthread_attr_destroy(&attr);
+    if (started == 0) {
+        fprintf(stderr, "Couldn't start workers\n");
+        return 1;
+    }
+
+    // Reads while the window has room and prints finished jobs in order,
+    // waiting for workers otherwise
+    double begun = clockSeconds();
+    long nodes = 0;
+    pthread_mutex_lock(&lock);
+    while (!input_done || printed_count < read_count) {
+        Job *next = &jobs[printed_count % window];
+        if (printed_count < read_count && next->done) {
+            pthread_mutex_unlock(&lock);
+            printJob(next, printed_count + 1);
+            nodes += next->valid ? next->report.nodes : 0;
+            pthread_mutex_lock(&lock);
+            printed_count++;
+            continue;
+        }
+        if (!input_done && read_count - printed_count < window) {
+            Job *job = &jobs[read_count % window];
+            pthread_mutex_unlock(&lock);
+            bool got = fgets(job->line, sizeof(job->line), in) != NULL;
+            if (got) {
+                job->valid = normalizeFEN(job->line, job->fen, sizeof(job->fen));
+                job->done = false;
+            }
+            pthread_mutex_lock(&lock);
+            if (got)
+                read_count++;
+            else
+                input_done = true;
+            pthread_cond_broadcast(&job_ready);
+            continue;
+        }
+        pthread_cond_wait(&job_done, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    double seconds = clockSeconds() - begun;
+    fprintf(stderr, "%ld positions on %d threads in %.2f s, %.1f per second, %ld knps\n", read_count, started,
+            seconds, seconds > 0 ? read_count / seconds : 0, seconds > 0 ? (long)(nodes / seconds / 1000) : 0);
+
+    if (in != stdin)
+        fclose(in);
+    free(jobs);
+    return 0;
+}
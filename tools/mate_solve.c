@@ -0,0 +1,163 @@
+// Proves forced mates with proof-number search, see src/proof.h. Built by
+// make mate-solve:
+//
+//     mate-solve <fen> <moves>            mate in at most moves, with its line
+//     mate-solve -b <moves> [threads]     one FEN or EPD per line of stdin
+//
+// Batch mode solves puzzles on one thread per core, each with its own
+// table, and prints a line per puzzle in input order. An EPD "dm n"
+// operation sets the mate to look for in that puzzle
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "proof.h"
+#include "tools.h"
+
+#define TABLE_MB            64
+#define BATCH_TABLE_MB      16      // per thread
+#define BATCH_NODE_LIMIT    2000000 // per puzzle, so one hard one can't stall a batch
+#define BATCH_STACK_SIZE    (1024 * 1024)
+#define MAX_BATCH_THREADS   256
+#define LINE_SIZE           512
+
+typedef struct {
+    char fen[LINE_SIZE];
+    int moves;
+    ProofResult result;
+} Puzzle;
+
+static Puzzle *puzzles = NULL;
+static int puzzle_count = 0;
+static atomic_int next_puzzle;
+
+static ProofResult solveFEN(ProofTable *t, char *fen, int moves, long node_limit)
+{
+    Board b = initBoardFromFEN(fen);
+    Position root;
+    positionFromBoard(&root, &b);
+    return proveMate(t, &root, moves, node_limit);
+}
+
+static void printLine(const ProofResult *r)
+{
+    for (int i = 0; i < r->line_length; i++) {
+        char move[6];
+        moveText(r->line[i], move);
+        printf(" %s", move);
+    }
+}
+
+static void *batchLoop(void *arg)
+{
+    (void)arg;
+    ProofTable t = newProofTable(BATCH_TABLE_MB);
+    int i;
+    while ((i = atomic_fetch_add(&next_puzzle, 1)) < puzzle_count)
+        puzzles[i].result = solveFEN(&t, puzzles[i].fen, puzzles[i].moves, BATCH_NODE_LIMIT);
+    freeProofTable(&t);
+    return NULL;
+}
+
+static int solveBatch(int moves, int threads)
+{
+    char line[LINE_SIZE];
+    int capacity = 0;
+    for (int number = 1; fgets(line, sizeof(line), stdin) != NULL; number++) {
+        char fen[LINE_SIZE];
+        if (!normalizeFEN(line, fen, sizeof(fen))) {
+            if (line[strspn(line, " \t\r\n")] != '\0')
+                fprintf(stderr, "line %d: invalid position\n", number);
+            continue;
+        }
+        if (puzzle_count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            puzzles = realloc(puzzles, sizeof(Puzzle) * capacity);
+            if (puzzles == NULL) {
+                fprintf(stderr, "Couldn't allocate puzzles\n");
+                return 1;
+            }
+        }
+        Puzzle *p = &puzzles[puzzle_count++];
+        strcpy(p->fen, fen);
+        char *dm = strstr(line, "dm ");
+        p->moves = (dm != NULL && atoi(dm + 3) > 0) ? atoi(dm + 3) : moves;
+    }
+
+    double started = clockSeconds();
+    atomic_init(&next_puzzle, 0);
+    pthread_t workers[MAX_BATCH_THREADS];
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BATCH_STACK_SIZE);
+    int started_threads = 0;
+    for (int i = 0; i < threads; i++)
+        if (pthread_create(&workers[started_threads], &attr, batchLoop, NULL) == 0)
+            started_threads++;
+    pthread_attr_destroy(&attr);
+    if (started_threads == 0)
+        batchLoop(NULL);
+    for (int i = 0; i < started_threads; i++)
+        pthread_join(workers[i], NULL);
+    double seconds = clockSeconds() - started;
+
+    int solved = 0;
+    long nodes = 0;
+    for (int i = 0; i < puzzle_count; i++) {
+        ProofResult *r = &puzzles[i].result;
+        nodes += r->nodes;
+        if (r->mate > 0) {
+            solved++;
+            printf("%d: mate %d,", i + 1, r->mate);
+            printLine(r);
+            printf("\n");
+        }
+        else {
+            printf("%d: %s\n", i + 1, r->out_of_nodes ? "unknown" : "no mate");
+        }
+    }
+    printf("%d of %d puzzles proven on %d threads in %.2f s, %.0f per minute, %ld knps\n", solved,
+           puzzle_count, started_threads ? started_threads : 1, seconds,
+           seconds > 0 ? puzzle_count * 60 / seconds : 0, seconds > 0 ? (long)(nodes / seconds / 1000) : 0);
+    free(puzzles);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    // Tables and rules set up once, before threads read them
+    initBoard();
+
+    if (argc >= 3 && strcmp(argv[1], "-b") == 0) {
+        int threads = (argc > 3) ? atoi(argv[3]) : suggestedWorkerCount() + 1;
+        threads = (threads < 1) ? 1 : (threads > MAX_BATCH_THREADS) ? MAX_BATCH_THREADS : threads;
+        return solveBatch(atoi(argv[2]), threads);
+    }
+    if (argc != 3) {
+        fprintf(stderr, "usage: mate-solve <fen> <moves>\n       mate-solve -b <moves> [threads] < puzzles\n");
+        return 1;
+    }
+
+    char fen[LINE_SIZE];
+    if (!normalizeFEN(argv[1], fen, sizeof(fen))) {
+        fprintf(stderr, "invalid fen: %s\n", argv[1]);
+        return 1;
+    }
+    ProofTable t = newProofTable(TABLE_MB);
+    ProofResult r = solveFEN(&t, fen, atoi(argv[2]), 0);
+    if (r.mate > 0) {
+        printf("mate in %d:", r.mate);
+        printLine(&r);
+        printf("\n");
+    }
+    else {
+        printf("no mate in %d\n", atoi(argv[2]));
+    }
+    printf("%ld nodes in %.3f s, %ld knps\n", r.nodes, r.seconds,
+           r.seconds > 0 ? (long)(r.nodes / r.seconds / 1000) : 0);
+    freeProofTable(&t);
+    return 0;
+}